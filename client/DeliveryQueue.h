@@ -0,0 +1,98 @@
+#ifndef DELIVERYQUEUE_H
+#define DELIVERYQUEUE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Черга повідомлень з номерами послідовності (MSG:seq|recipient|text).
+// Повідомлення відправляються без очікування підтвердження кожного, сервер відсіює
+// дублікати, тому після перепідключення всі непідтверджені можна відправити ще раз.
+// Без Qt - перевіряється в tests/client_tests.cpp.
+class DeliveryQueue {
+public:
+    explicit DeliveryQueue(uint64_t maxInFlight) : maxInFlight(maxInFlight) {}
+
+    // Додати повідомлення ("recipient|text"); повертає його номер
+    uint64_t push(const std::string& payload) {
+        uint64_t seq = nextSeq++;
+        pending[seq] = payload;
+        return seq;
+    }
+
+    // ACK:seq - сервер прийняв усі номери до seq включно
+    void acknowledge(uint64_t seq) {
+        if (seq <= acked) return;
+        acked = seq;
+        while (!pending.empty() && pending.begin()->first <= seq) {
+            pending.erase(pending.begin());
+        }
+    }
+
+    // Відповідь SESSION:seq на початку з'єднання. Номер, менший за вже підтверджений,
+    // означає, що сервер втратив вікно цього клієнта (витіснене, прострочене або сервер
+    // впав без збереження стану): непідтверджені перенумеровуються з seq + 1, інакше
+    // номер сервера ніколи не зрушить і повідомлення вийдуть за межі його вікна.
+    // Повертає true, якщо черга перенумерована.
+    bool resume(uint64_t seq) {
+        bool resynced = seq < acked;
+        if (resynced) {
+            std::map<uint64_t, std::string> renumbered;
+            uint64_t next = seq;
+            for (auto& pair : pending) {
+                renumbered.emplace(++next, std::move(pair.second));
+            }
+            pending.swap(renumbered);
+            acked = seq;
+            nextSeq = next + 1;
+        } else {
+            acknowledge(seq);
+        }
+        sentUpTo = acked;
+        return resynced;
+    }
+
+    // Кадри, що ще не відправлялись у цьому з'єднанні, не більше maxInFlight від підтвердженого
+    std::vector<std::string> takeSendable() {
+        std::vector<std::string> frames;
+        for (auto it = pending.upper_bound(sentUpTo); it != pending.end() && it->first <= acked + maxInFlight; ++it) {
+            frames.push_back("MSG:" + std::to_string(it->first) + "|" + it->second);
+            sentUpTo = it->first;
+        }
+        return frames;
+    }
+
+    // Відправити все непідтверджене ще раз (після ERROR:Rate limited)
+    void rewind() {
+        sentUpTo = acked;
+    }
+
+    void clear() {
+        pending.clear();
+        nextSeq = 1;
+        acked = 0;
+        sentUpTo = 0;
+    }
+
+    size_t size() const {
+        return pending.size();
+    }
+
+    bool empty() const {
+        return pending.empty();
+    }
+
+    uint64_t ackedSeq() const {
+        return acked;
+    }
+
+private:
+    const uint64_t maxInFlight;
+    std::map<uint64_t, std::string> pending;  // seq -> "recipient|text", ще не підтверджене сервером
+    uint64_t nextSeq = 1;
+    uint64_t acked = 0;     // Сервер прийняв усі номери до цього включно
+    uint64_t sentUpTo = 0;  // Найбільший номер, відправлений у поточному з'єднанні
+};
+
+#endif // DELIVERYQUEUE_H
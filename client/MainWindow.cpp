@@ -5,17 +5,68 @@
 #include <QAction>
 #include <QTimer>
 #include <QDebug>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QHash>
+#include <QSslConfiguration>
+#include <QUuid>
+#include <QUrlQuery>
+#include <QFileInfo>
+#include <QFileDialog>
 
 #include "ui_MainWindow.h"
 
+static const quint16 DEFAULT_SERVER_PORT = 12345;
+
+// Session tickets від сервера ("host:port" -> ticket), спільні для всіх вікон.
+// Повторне підключення з тікетом пропускає повний TLS handshake.
+static QHash<QString, QByteArray> s_sessionTickets;
+
+// Сертифікати, яким користувач явно довіряє (або server.crt поруч з клієнтом)
+static QList<QSslCertificate> s_trustedCertificates;
+
+// Heartbeat: PING після 20 с тиші від сервера, розрив після 45 с
+static const int HEARTBEAT_CHECK_MS = 5000;
+static const qint64 HEARTBEAT_PING_MS = 20000;
+static const qint64 HEARTBEAT_TIMEOUT_MS = 45000;
+
+// Скільки непідтверджених повідомлень можна мати "в дорозі" (менше за вікно сервера)
+static const quint64 MAX_IN_FLIGHT = 512;
+
+// Вкладення передаються шматками; в дорозі не більше UPLOAD_WINDOW шматків,
+// щоб повідомлення чату не стояли в черзі за великим файлом
+static const qint64 FILE_CHUNK_SIZE = 64 * 1024;
+static const qint64 UPLOAD_WINDOW = 4;
+static const qint64 MAX_ATTACHMENT_SIZE = 256ll * 1024 * 1024;
+
+// Ефемерні події: typing=1 повторюється не частіше ніж раз на 3 с і знімається
+// після 4 с без змін; у співрозмовника індикатор гасне сам, якщо оновлення загубилось
+static const int TYPING_IDLE_MS = 4000;
+static const qint64 TYPING_RESEND_MS = 3000;
+static const qint64 TYPING_EXPIRY_MS = 6000;
+static const qint64 VIEWING_RESEND_MS = 15000;
+static const qint64 VIEWING_EXPIRY_MS = 35000;
+
+// Після ERROR:Rate limited відхилені повідомлення і шматки файлів повторюються через паузу
+static const int RATE_LIMIT_BACKOFF_MS = 1000;
+
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent), ui(new Ui::MainWindow) {
+    : QMainWindow(parent), ui(new Ui::MainWindow), outgoing(MAX_IN_FLIGHT) {
     ui->setupUi(this);
 
     qDebug() << "[MainWindow] Creating new window instance";
 
     setupMenuBar();
-    socket = new QTcpSocket(this);
+    resetDeliverySession();
+    socket = new QSslSocket(this);
+    heartbeatTimer = new QTimer(this);
+    heartbeatTimer->setInterval(HEARTBEAT_CHECK_MS);
+    connect(heartbeatTimer, &QTimer::timeout, this, &MainWindow::onHeartbeatTimer);
+    typingTimer = new QTimer(this);
+    typingTimer->setSingleShot(true);
+    typingTimer->setInterval(TYPING_IDLE_MS);
+    connect(typingTimer, &QTimer::timeout, this, &MainWindow::stopTyping);
 
     if (!ui->btnConnect || !ui->btnRegister || !ui->btnLogin ||
         !ui->btnLogout || !ui->btnSend || !ui->userList) {
@@ -24,16 +75,23 @@ MainWindow::MainWindow(QWidget *parent)
         return;
     }
 
-    connect(socket, &QTcpSocket::connected, this, &MainWindow::onConnected);
-    connect(socket, &QTcpSocket::disconnected, this, &MainWindow::onDisconnected);
-    connect(socket, &QTcpSocket::readyRead, this, &MainWindow::onReadyRead);
-    connect(socket, &QTcpSocket::errorOccurred, this, &MainWindow::onError);
+    // Вважаємо з'єднання встановленим тільки після завершення TLS handshake
+    connect(socket, &QSslSocket::encrypted, this, &MainWindow::onConnected);
+    connect(socket, &QSslSocket::disconnected, this, &MainWindow::onDisconnected);
+    connect(socket, &QSslSocket::readyRead, this, &MainWindow::onReadyRead);
+    connect(socket, &QSslSocket::errorOccurred, this, &MainWindow::onError);
+    connect(socket, QOverload<const QList<QSslError>&>::of(&QSslSocket::sslErrors),
+            this, &MainWindow::onSslErrors);
+    connect(socket, &QSslSocket::newSessionTicketReceived, this, &MainWindow::onNewSessionTicket);
 
     connect(ui->btnConnect, &QPushButton::clicked, this, &MainWindow::onConnectClicked);
     connect(ui->btnRegister, &QPushButton::clicked, this, &MainWindow::onRegisterClicked);
     connect(ui->btnLogin, &QPushButton::clicked, this, &MainWindow::onLoginClicked);
     connect(ui->btnLogout, &QPushButton::clicked, this, &MainWindow::onLogoutClicked);
     connect(ui->btnSend, &QPushButton::clicked, this, &MainWindow::onSendClicked);
+    connect(ui->btnAttach, &QPushButton::clicked, this, &MainWindow::onAttachClicked);
+    connect(ui->txtMessage, &QLineEdit::textEdited, this, &MainWindow::onMessageEdited);
+    connect(ui->chatDisplay, &QTextBrowser::anchorClicked, this, &MainWindow::onAnchorClicked);
     connect(ui->userList, &QListWidget::itemClicked, this, &MainWindow::onUserSelected);
 
     qDebug() << "[MainWindow] All signals connected successfully";
@@ -41,13 +99,16 @@ MainWindow::MainWindow(QWidget *parent)
     ui->authPanel->setEnabled(false);
     ui->chatPanel->setEnabled(false);
     ui->btnSend->setEnabled(false);
+    ui->btnAttach->setEnabled(false);
     ui->btnLogout->setEnabled(false);
 }
 
 MainWindow::~MainWindow() {
     qDebug() << "[MainWindow] Destroying window for user:" << username;
-    if (socket->state() == QAbstractSocket::ConnectedState && authenticated) {
+    if (socket->isEncrypted() && authenticated) {
         sendMessage("LOGOUT");
+        flushPendingWrites();
+        socket->flush();
     }
     delete ui;
 }
@@ -96,11 +157,93 @@ void MainWindow::onConnectClicked() {
         return;
     }
 
+    // Адреса у форматі "host" або "host:port"
+    quint16 port = DEFAULT_SERVER_PORT;
+    int colonPos = ip.lastIndexOf(':');
+    if (colonPos > 0) {
+        bool ok;
+        port = ip.mid(colonPos + 1).toUShort(&ok);
+        if (!ok) {
+            QMessageBox::warning(this, "Error", "Invalid server port");
+            return;
+        }
+        ip = ip.left(colonPos);
+    }
+
+    redirectCommand.clear();
+    connectToServer(ip, port);
+}
+
+void MainWindow::connectToServer(const QString& host, quint16 port) {
     ui->btnConnect->setEnabled(false);
     ui->btnConnect->setText("Connecting...");
 
-    qDebug() << "[MainWindow] Connecting to" << ip << ":12345";
-    socket->connectToHost(ip, 12345);
+    QSslConfiguration config = socket->sslConfiguration();
+    config.setProtocol(QSsl::TlsV1_2OrLater);
+    config.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+
+    // server.crt поруч з клієнтом - сертифікат сервера, якому довіряємо (pinning)
+    QString pinnedPath = QCoreApplication::applicationDirPath() + "/server.crt";
+    QFile pinnedFile(pinnedPath);
+    if (pinnedFile.open(QIODevice::ReadOnly)) {
+        for (const QSslCertificate& cert : QSslCertificate::fromData(pinnedFile.readAll())) {
+            if (!s_trustedCertificates.contains(cert)) {
+                s_trustedCertificates.append(cert);
+            }
+        }
+    }
+    config.addCaCertificates(s_trustedCertificates);
+
+    serverHost = host + ":" + QString::number(port);
+
+    // Відновити попередню TLS-сесію, якщо є тікет для цього сервера
+    if (s_sessionTickets.contains(serverHost)) {
+        qDebug() << "[MainWindow] Resuming TLS session with" << serverHost;
+        config.setSessionTicket(s_sessionTickets.value(serverHost));
+    }
+    socket->setSslConfiguration(config);
+
+    qDebug() << "[MainWindow] Connecting to" << serverHost << "(TLS)";
+    socket->connectToHostEncrypted(host, port);
+}
+
+void MainWindow::onSslErrors(const QList<QSslError>& errors) {
+    QSslCertificate peer = socket->peerCertificate();
+
+    // Сертифікат закріплений - ігнорувати невідповідність імені хоста (підключення за IP)
+    if (!peer.isNull() && s_trustedCertificates.contains(peer)) {
+        socket->ignoreSslErrors(errors);
+        return;
+    }
+
+    QStringList messages;
+    for (const QSslError& error : errors) {
+        qWarning() << "[MainWindow] SSL error:" << error.errorString();
+        messages << error.errorString();
+    }
+
+    QString fingerprint = peer.isNull()
+        ? QString("<none>")
+        : QString::fromLatin1(peer.digest(QCryptographicHash::Sha256).toHex(':'));
+
+    auto answer = QMessageBox::question(this, "Untrusted certificate",
+        "The server certificate is not trusted:\n" + messages.join("\n") +
+        "\n\nSHA-256 fingerprint:\n" + fingerprint +
+        "\n\nTrust this certificate?");
+
+    if (answer == QMessageBox::Yes && !peer.isNull()) {
+        s_trustedCertificates.append(peer);
+        socket->ignoreSslErrors(errors);
+    }
+}
+
+void MainWindow::onNewSessionTicket() {
+    QByteArray ticket = socket->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        s_sessionTickets.insert(serverHost, ticket);
+        qDebug() << "[MainWindow] Stored TLS session ticket for" << serverHost;
+    }
 }
 
 void MainWindow::onConnected() {
@@ -110,9 +253,36 @@ void MainWindow::onConnected() {
     ui->authPanel->setEnabled(true);
     ui->connectionPanel->setEnabled(false);
 
+    lastReceived.start();
+    heartbeatTimer->start();
+
+    // Після REDIRECT - повторити REG/LOGIN на вузлі-власнику
+    if (!redirectCommand.isEmpty()) {
+        sendMessage(redirectCommand);
+        redirectCommand.clear();
+    }
+
     setWindowTitle("Corporate Messenger - Connected");
 }
 
+void MainWindow::onHeartbeatTimer() {
+    qint64 silence = lastReceived.elapsed();
+
+    if (silence >= HEARTBEAT_TIMEOUT_MS) {
+        qWarning() << "[MainWindow] Heartbeat timeout, dropping connection";
+        heartbeatTimer->stop();
+        socket->abort();
+    } else if (silence >= HEARTBEAT_PING_MS) {
+        sendMessage("PING");
+    }
+
+    // Підтвердити, що чат досі відкритий, і погасити прострочені індикатори
+    if (authenticated && !currentChat.isEmpty() && (!viewingSentAt.isValid() || viewingSentAt.elapsed() >= VIEWING_RESEND_MS)) {
+        sendEphemeral(currentChat, "viewing", true);
+    }
+    updateChatHeader();
+}
+
 void MainWindow::onDisconnected() {
     qDebug() << "[MainWindow] Disconnected from server";
     ui->statusbar->showMessage("Disconnected from server");
@@ -123,7 +293,20 @@ void MainWindow::onDisconnected() {
     ui->connectionPanel->setEnabled(true);
     ui->btnLogout->setEnabled(false);
     authenticated = false;
+    deliverySessionReady = false;  // Непідтверджені повідомлення буде повторено після входу
+    heartbeatTimer->stop();
     receiveBuffer.clear();  // Очистити буфер
+    pendingWrite.clear();
+
+    // Перехід на інший вузол кластера - не показувати помилку
+    if (redirectPort != 0) {
+        QString host = redirectHost;
+        quint16 port = redirectPort;
+        redirectPort = 0;
+        QTimer::singleShot(redirectDelayMs, this, [this, host, port]() { connectToServer(host, port); });
+        redirectDelayMs = 0;
+        return;
+    }
 
     setWindowTitle("Corporate Messenger - Disconnected");
 
@@ -133,6 +316,7 @@ void MainWindow::onDisconnected() {
 void MainWindow::onReadyRead() {
     // Додати нові дані до буфера
     receiveBuffer.append(socket->readAll());
+    lastReceived.restart();
 
     // Обробити всі повні повідомлення в буфері
     while (true) {
@@ -158,9 +342,17 @@ void MainWindow::onReadyRead() {
         }
 
         // Витягти повідомлення
-        QString msg = QString::fromUtf8(receiveBuffer.mid(colonPos + 1, msgLength));
+        QByteArray frame = receiveBuffer.mid(colonPos + 1, msgLength);
         receiveBuffer.remove(0, totalLength);
 
+        // Шматки файлів - двійкові дані, не текст
+        if (frame.startsWith("FILE_CHUNK:")) {
+            handleFileChunk(frame);
+            continue;
+        }
+
+        QString msg = QString::fromUtf8(frame);
+
         qDebug() << "[MainWindow] Received:" << msg.left(50);
         parseMessage(msg);
     }
@@ -175,20 +367,50 @@ void MainWindow::onError(QAbstractSocket::SocketError error) {
 }
 
 void MainWindow::sendMessage(const QString& msg) {
-    if (socket->state() != QAbstractSocket::ConnectedState) {
+    if (!socket->isEncrypted()) {
         qWarning() << "[MainWindow] Not connected, cannot send message";
         QMessageBox::warning(this, "Error", "Not connected to server");
         return;
     }
 
-    QString packet = QString::number(msg.length()) + ":" + msg;
-    socket->write(packet.toUtf8());
-    socket->flush();
-    qDebug() << "[MainWindow] Sent:" << msg.left(50);
+    // Довжина кадру - в байтах UTF-8, а не в символах QString
+    sendFrame(msg.toUtf8());
+    qDebug() << "[MainWindow] Queued:" << msg.left(50);
+}
+
+void MainWindow::sendFrame(const QByteArray& payload) {
+    if (!socket->isEncrypted()) {
+        return;
+    }
+
+    pendingWrite.append(QByteArray::number(payload.size()) + ':' + payload);
+
+    // Усі кадри за одну ітерацію циклу подій підуть одним write() (одним TLS-записом)
+    if (!flushScheduled) {
+        flushScheduled = true;
+        QTimer::singleShot(0, this, &MainWindow::flushPendingWrites);
+    }
+}
+
+void MainWindow::flushPendingWrites() {
+    flushScheduled = false;
+    if (pendingWrite.isEmpty() || !socket->isEncrypted()) {
+        return;
+    }
+
+    socket->write(pendingWrite);
+    qDebug() << "[MainWindow] Sent" << pendingWrite.size() << "bytes";
+    pendingWrite.clear();
 }
 
 void MainWindow::parseMessage(const QString& msg) {
-    if (msg.startsWith("OK:")) {
+    if (msg == "PING") {
+        sendMessage("PONG");
+    }
+    else if (msg == "PONG") {
+        // Сервер живий - час отримання вже оновлено
+    }
+    else if (msg.startsWith("OK:")) {
         QString response = msg.mid(3);
         if (response == "Registered") {
             qDebug() << "[MainWindow] Registration successful";
@@ -203,6 +425,13 @@ void MainWindow::parseMessage(const QString& msg) {
             ui->statusbar->showMessage("Logged in as " + username);
             setWindowTitle("Corporate Messenger - " + username);
 
+            // Номери послідовності прив'язані до користувача
+            if (sessionUser != username) {
+                resetDeliverySession();
+                sessionUser = username;
+            }
+            sendMessage("SESSION:" + clientId);
+
             QTimer::singleShot(500, this, [this]() {
                 sendMessage("GET_USERS");
             });
@@ -210,6 +439,148 @@ void MainWindow::parseMessage(const QString& msg) {
             // Повідомлення відправлено
         }
     }
+    else if (msg.startsWith("SESSION:")) {
+        // Сервер повідомляє, до якого номера все вже прийнято - решту відправити повторно
+        quint64 seq = msg.mid(8).toULongLong();
+        qDebug() << "[MainWindow] Delivery session ready, server has up to #" << seq;
+        if (outgoing.resume(seq)) {
+            qWarning() << "[MainWindow] Server lost the delivery window, unacknowledged messages renumbered";
+        }
+        deliverySessionReady = true;
+        pumpOutgoing();
+        resumeTransfers();
+        updateDeliveryStatus();
+    }
+    else if (msg.startsWith("UPLOAD_RESUME:") || msg.startsWith("UPLOAD_ACK:")) {
+        // UPLOAD_RESUME - надсилати з цього зсуву; UPLOAD_ACK - сервер записав до цього зсуву
+        bool resume = msg.startsWith("UPLOAD_RESUME:");
+        QStringList parts = msg.mid(msg.indexOf(':') + 1).split('|');
+        if (parts.size() == 2 && uploads.contains(parts[0])) {
+            FileTransfer& upload = uploads[parts[0]];
+            upload.acked = parts[1].toLongLong();
+            if (resume) {
+                upload.sent = upload.acked;
+                upload.accepted = true;
+            }
+            ui->statusbar->showMessage(QString("Uploading %1: %2%").arg(upload.name)
+                                       .arg(upload.size ? upload.acked * 100 / upload.size : 100));
+            pumpUploads();
+        }
+    }
+    else if (msg.startsWith("UPLOAD_DONE:")) {
+        QString hash = msg.mid(12);
+        if (uploads.contains(hash)) {
+            FileTransfer upload = uploads.take(hash);
+            qDebug() << "[MainWindow] Upload finished:" << upload.name;
+            storeChatMessage(upload.peer, "[file] " + upload.name, true);
+            if (upload.peer == currentChat) {
+                addAttachmentMessage(username, hash, upload.size, upload.name, true);
+            }
+            ui->statusbar->showMessage("Sent " + upload.name, 3000);
+        }
+    }
+    else if (msg.startsWith("EVENTS:")) {
+        // EVENTS:from|kind|value\n... - лише останній стан кожної події
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        for (const QString& line : msg.mid(7).split('\n', Qt::SkipEmptyParts)) {
+            QStringList parts = line.split('|');
+            if (parts.size() != 3) {
+                continue;
+            }
+
+            bool active = parts[2] == "1";
+            if (parts[1] == "typing") {
+                typingUntil[parts[0]] = active ? now + TYPING_EXPIRY_MS : 0;
+                if (active) {
+                    QTimer::singleShot(TYPING_EXPIRY_MS + 100, this, &MainWindow::updateChatHeader);
+                }
+            } else if (parts[1] == "viewing") {
+                viewingUntil[parts[0]] = active ? now + VIEWING_EXPIRY_MS : 0;
+            }
+        }
+        updateChatHeader();
+    }
+    else if (msg.startsWith("FILE:")) {
+        // FILE:from|sha256|size|filename
+        QString data = msg.mid(5);
+        QStringList parts = data.split('|');
+        if (parts.size() >= 4) {
+            QString from = parts[0];
+            QString hash = parts[1];
+            qint64 size = parts[2].toLongLong();
+            QString name = data.section('|', 3);
+
+            if (isLoadingHistory) {
+                if (from == currentChat || from == username) {
+                    addAttachmentMessage(from, hash, size, name, from == username);
+                }
+            } else {
+                storeChatMessage(from, "[file] " + name, false);
+                if (from == currentChat) {
+                    addAttachmentMessage(from, hash, size, name, false);
+                }
+                ui->statusbar->showMessage("📎 New file from " + from, 5000);
+            }
+        }
+    }
+    else if (msg.startsWith("ACK:")) {
+        outgoing.acknowledge(msg.mid(4).toULongLong());
+        pumpOutgoing();
+        updateDeliveryStatus();
+    }
+    else if (msg.startsWith("REDIRECT:")) {
+        // Користувач належить іншому вузлу кластера: REDIRECT:host:port
+        QString target = msg.mid(9);
+        int colonPos = target.lastIndexOf(':');
+        redirectHost = target.left(colonPos);
+        redirectPort = target.mid(colonPos + 1).toUShort();
+        redirectCommand = lastAuthCommand;
+
+        qDebug() << "[MainWindow] Redirected to" << target;
+        ui->statusbar->showMessage("Redirecting to " + target + "...");
+        socket->disconnectFromHost();
+    }
+    else if (msg.startsWith("RECONNECT:")) {
+        // Сервер перезапускається: повернутися на ту саму адресу після вказаної паузи
+        // (у кожного клієнта своя, тому немає шторму підключень). TLS-сесія відновиться
+        // за тікетом, після входу непідтверджені повідомлення і файли будуть дослані
+        int colonPos = serverHost.lastIndexOf(':');
+        redirectHost = serverHost.left(colonPos);
+        redirectPort = serverHost.mid(colonPos + 1).toUShort();
+        redirectDelayMs = msg.mid(10).toInt();
+        redirectCommand = authenticated && lastAuthCommand.startsWith("LOGIN:") ? lastAuthCommand : QString();
+        ui->statusbar->showMessage("Server is restarting, reconnecting...");
+    }
+    else if (msg == "ERROR:Rate limited") {
+        // Сервер відкинув частину команд без обробки - не показувати діалог,
+        // а відправити непідтверджене ще раз трохи пізніше
+        ui->statusbar->showMessage("Server is busy, retrying...", RATE_LIMIT_BACKOFF_MS * 2);
+        if (!rateLimitRetryScheduled) {
+            rateLimitRetryScheduled = true;
+            QTimer::singleShot(RATE_LIMIT_BACKOFF_MS, this, &MainWindow::retryAfterRateLimit);
+        }
+    }
+    else if (msg.startsWith("ERROR:Attachment storage failed|")) {
+        // Файл отримано повністю, але сервер не зміг його зберегти - байти лишились
+        // на сервері, тож повторна заявка UPLOAD через паузу лише повторить збереження
+        QString hash = msg.mid(msg.indexOf('|') + 1);
+        if (uploads.contains(hash)) {
+            uploads[hash].accepted = false;
+            ui->statusbar->showMessage("Server could not store " + uploads[hash].name + ", retrying...",
+                                       RATE_LIMIT_BACKOFF_MS * 2);
+            if (!rateLimitRetryScheduled) {
+                rateLimitRetryScheduled = true;
+                QTimer::singleShot(RATE_LIMIT_BACKOFF_MS, this, &MainWindow::retryAfterRateLimit);
+            }
+        }
+    }
+    else if (msg == "ERROR:Sequence out of window") {
+        // Номери розійшлися з вікном сервера - узгодити заново через SESSION
+        if (deliverySessionReady) {
+            deliverySessionReady = false;
+            sendMessage("SESSION:" + clientId);
+        }
+    }
     else if (msg.startsWith("ERROR:")) {
         QString error = msg.mid(6);
         qWarning() << "[MainWindow] Server error:" << error;
@@ -269,6 +640,10 @@ void MainWindow::parseMessage(const QString& msg) {
                 addChatMessage(from, text, false);
             }
 
+            // Повідомлення надіслано - співрозмовник вже не набирає
+            typingUntil.remove(from);
+            updateChatHeader();
+
             ui->statusbar->showMessage("💬 New message from " + from, 5000);
 
             if (!isActiveWindow()) {
@@ -290,7 +665,8 @@ void MainWindow::onRegisterClicked() {
     }
 
     qDebug() << "[MainWindow] Registering user:" << user;
-    sendMessage("REG:" + user + "|" + pass + "|" + dept);
+    lastAuthCommand = "REG:" + user + "|" + pass + "|" + dept;
+    sendMessage(lastAuthCommand);
 }
 
 void MainWindow::onLoginClicked() {
@@ -305,12 +681,14 @@ void MainWindow::onLoginClicked() {
 
     username = user;
     qDebug() << "[MainWindow] Logging in as:" << username;
-    sendMessage("LOGIN:" + user + "|" + pass);
+    lastAuthCommand = "LOGIN:" + user + "|" + pass;
+    sendMessage(lastAuthCommand);
 }
 
 void MainWindow::onLogoutClicked() {
     qDebug() << "[MainWindow] Logout button clicked";
     if (authenticated) {
+        stopTyping();
         sendMessage("LOGOUT");
         authenticated = false;
         ui->authPanel->setEnabled(true);
@@ -322,6 +700,11 @@ void MainWindow::onLogoutClicked() {
         currentChat.clear();
         username.clear();
         chatHistory.clear();
+        resetDeliverySession();
+        uploads.clear();
+        downloads.clear();
+        typingUntil.clear();
+        viewingUntil.clear();
         setWindowTitle("Corporate Messenger - Connected");
         ui->statusbar->showMessage("Logged out", 3000);
     }
@@ -334,8 +717,10 @@ void MainWindow::onSendClicked() {
         return;
     }
 
-    qDebug() << "[MainWindow] Sending message to" << currentChat << ":" << text;
-    sendMessage("MSG:" + currentChat + "|" + text);
+    quint64 seq = outgoing.push((currentChat + "|" + text).toStdString());
+    qDebug() << "[MainWindow] Sending message #" << seq << "to" << currentChat << ":" << text;
+    pumpOutgoing();
+    updateDeliveryStatus();
 
     // Зберегти своє повідомлення в локальній історії
     storeChatMessage(currentChat, text, true);
@@ -343,15 +728,27 @@ void MainWindow::onSendClicked() {
     // Показати своє повідомлення відразу
     addChatMessage(username, text, true);
 
+    stopTyping();
     ui->txtMessage->clear();
     ui->txtMessage->setFocus();
 }
 
 void MainWindow::onUserSelected(QListWidgetItem* item) {
+    QString previousChat = currentChat;
+    stopTyping();
+
     currentChat = item->data(Qt::UserRole).toString();
     qDebug() << "[MainWindow] Selected user:" << currentChat;
-    ui->lblChatWith->setText("Chat with: " + currentChat);
+    updateChatHeader();
+
+    if (previousChat != currentChat) {
+        if (!previousChat.isEmpty()) {
+            sendEphemeral(previousChat, "viewing", false);
+        }
+        sendEphemeral(currentChat, "viewing", true);
+    }
     ui->btnSend->setEnabled(true);
+    ui->btnAttach->setEnabled(true);
     ui->chatDisplay->clear();
 
     // Увімкнути режим завантаження історії
@@ -407,4 +804,294 @@ void MainWindow::storeChatMessage(const QString& otherUser, const QString& text,
 
     chatHistory.append(msg);
     qDebug() << "[MainWindow] Stored message in history:" << from << "->" << to;
+}
+
+void MainWindow::resetDeliverySession() {
+    clientId = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    sessionUser.clear();
+    deliverySessionReady = false;
+    outgoing.clear();
+}
+
+// Відправити непідтверджені повідомлення, що ще не відправлялись у цьому з'єднанні
+void MainWindow::pumpOutgoing() {
+    if (!authenticated || !deliverySessionReady) {
+        return;
+    }
+
+    for (const std::string& frame : outgoing.takeSendable()) {
+        sendMessage(QString::fromStdString(frame));
+    }
+}
+
+// Повторити все, що могло бути відхилене: сервер відсіє дублікати повідомлень
+// за номерами, а для файлів сам повідомить правильний зсув через UPLOAD_RESUME.
+// Без відповіді на SESSION повторюється сам SESSION - решту продовжить його відповідь.
+void MainWindow::retryAfterRateLimit() {
+    rateLimitRetryScheduled = false;
+    if (!authenticated) {
+        return;
+    }
+    if (!deliverySessionReady) {
+        sendMessage("SESSION:" + clientId);
+        return;
+    }
+
+    outgoing.rewind();
+    pumpOutgoing();
+
+    for (FileTransfer& upload : uploads) {
+        if (upload.accepted) {
+            upload.sent = upload.acked;
+        } else {
+            requestUpload(upload);
+        }
+    }
+    pumpUploads();
+}
+
+void MainWindow::updateDeliveryStatus() {
+    if (outgoing.empty()) {
+        ui->statusbar->showMessage("All messages delivered", 2000);
+    } else {
+        ui->statusbar->showMessage(QString("Sending... %1 message(s) not yet acknowledged").arg(outgoing.size()));
+    }
+}
+
+void MainWindow::onAttachClicked() {
+    if (currentChat.isEmpty() || !authenticated) {
+        return;
+    }
+
+    QString path = QFileDialog::getOpenFileName(this, "Attach file");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    auto file = QSharedPointer<QFile>::create(path);
+    if (!file->open(QIODevice::ReadOnly)) {
+        QMessageBox::warning(this, "Error", "Cannot open file: " + file->errorString());
+        return;
+    }
+    if (file->size() == 0 || file->size() > MAX_ATTACHMENT_SIZE) {
+        QMessageBox::warning(this, "Error", "File must be between 1 byte and 256 MB");
+        return;
+    }
+
+    // Хеш вмісту - ідентифікатор файлу: однакові файли на сервері зберігаються один раз
+    QCryptographicHash sha256(QCryptographicHash::Sha256);
+    sha256.addData(file.data());
+
+    FileTransfer upload;
+    upload.hash = QString::fromLatin1(sha256.result().toHex());
+    upload.name = QFileInfo(path).fileName();
+    upload.peer = currentChat;
+    upload.size = file->size();
+    upload.path = path;
+    upload.file = file;
+    qDebug() << "[MainWindow] Uploading" << upload.name << upload.size << "bytes, sha256" << upload.hash;
+    requestUpload(uploads.insert(upload.hash, upload).value());
+}
+
+// Попросити сервер прийняти файл; шматки підуть після UPLOAD_RESUME
+void MainWindow::requestUpload(FileTransfer& upload) {
+    upload.accepted = false;
+    sendMessage("UPLOAD:" + upload.peer + "|" + upload.hash + "|" + QString::number(upload.size) + "|" + upload.name);
+}
+
+// Надіслати наступні шматки, поки в дорозі менше UPLOAD_WINDOW шматків
+void MainWindow::pumpUploads() {
+    if (!authenticated || !socket->isEncrypted()) {
+        return;
+    }
+
+    for (FileTransfer& upload : uploads) {
+        if (!upload.accepted) {
+            continue;
+        }
+        while (upload.sent < upload.size && upload.sent - upload.acked < UPLOAD_WINDOW * FILE_CHUNK_SIZE) {
+            if (!upload.file->seek(upload.sent)) {
+                break;
+            }
+            QByteArray data = upload.file->read(FILE_CHUNK_SIZE);
+            if (data.isEmpty()) {
+                break;
+            }
+
+            sendFrame("CHUNK:" + upload.hash.toLatin1() + "|" + QByteArray::number(upload.sent) + "|" + data);
+            upload.sent += data.size();
+        }
+    }
+}
+
+// Після повторного входу продовжити незавершені передачі з місця обриву
+void MainWindow::resumeTransfers() {
+    for (FileTransfer& upload : uploads) {
+        requestUpload(upload);
+    }
+    for (const FileTransfer& download : downloads) {
+        sendMessage("DOWNLOAD:" + download.hash + "|" + QString::number(download.acked));
+    }
+}
+
+void MainWindow::onAnchorClicked(const QUrl& url) {
+    if (url.scheme() != "attachment") {
+        return;
+    }
+
+    QUrlQuery query(url);
+    FileTransfer download;
+    download.hash = url.path();
+    download.name = query.queryItemValue("name", QUrl::FullyDecoded);
+    download.size = query.queryItemValue("size").toLongLong();
+
+    if (downloads.contains(download.hash)) {
+        ui->statusbar->showMessage("Already downloading " + download.name, 3000);
+        return;
+    }
+
+    download.path = QFileDialog::getSaveFileName(this, "Save attachment", download.name);
+    if (download.path.isEmpty()) {
+        return;
+    }
+
+    // Незавершений файл .part від попередньої спроби - продовжити з його кінця
+    download.file = QSharedPointer<QFile>::create(download.path + ".part");
+    if (!download.file->open(QIODevice::ReadWrite)) {
+        QMessageBox::warning(this, "Error", "Cannot write file: " + download.file->errorString());
+        return;
+    }
+    if (download.file->size() > download.size) {
+        download.file->resize(0);
+    }
+    download.acked = download.file->size();
+    download.file->seek(download.acked);
+    downloads.insert(download.hash, download);
+
+    // Усі байти вже отримано в попередній спробі - лише перевірити і перейменувати
+    if (download.acked == download.size) {
+        finishDownload(download.hash);
+        return;
+    }
+
+    qDebug() << "[MainWindow] Downloading" << download.name << "from offset" << download.acked;
+    sendMessage("DOWNLOAD:" + download.hash + "|" + QString::number(download.acked));
+}
+
+// FILE_CHUNK:sha256|offset|дані
+void MainWindow::handleFileChunk(const QByteArray& frame) {
+    int pos1 = frame.indexOf('|', 11);
+    int pos2 = frame.indexOf('|', pos1 + 1);
+    if (pos1 < 0 || pos2 < 0) {
+        return;
+    }
+
+    QString hash = QString::fromLatin1(frame.mid(11, pos1 - 11));
+    qint64 offset = frame.mid(pos1 + 1, pos2 - pos1 - 1).toLongLong();
+    if (!downloads.contains(hash)) {
+        return;
+    }
+
+    FileTransfer& download = downloads[hash];
+    if (offset != download.acked) {
+        return;  // Повтор після перепідключення - ці байти вже записано
+    }
+
+    download.file->write(frame.constData() + pos2 + 1, frame.size() - pos2 - 1);
+    download.acked += frame.size() - pos2 - 1;
+
+    if (download.acked < download.size) {
+        ui->statusbar->showMessage(QString("Downloading %1: %2%").arg(download.name)
+                                   .arg(download.acked * 100 / download.size));
+        return;
+    }
+
+    finishDownload(hash);
+}
+
+// Перевірити цілісність і перейменувати .part у кінцевий файл
+void MainWindow::finishDownload(const QString& hash) {
+    FileTransfer finished = downloads.take(hash);
+    finished.file->seek(0);
+    QCryptographicHash sha256(QCryptographicHash::Sha256);
+    sha256.addData(finished.file.data());
+    finished.file->close();
+
+    if (QString::fromLatin1(sha256.result().toHex()) != hash) {
+        finished.file->remove();
+        QMessageBox::warning(this, "Error", "Downloaded file is corrupted: " + finished.name);
+        return;
+    }
+
+    QFile::remove(finished.path);
+    finished.file->rename(finished.path);
+    ui->statusbar->showMessage("Saved " + finished.path, 5000);
+}
+
+void MainWindow::addAttachmentMessage(const QString& from, const QString& hash, qint64 size,
+                                      const QString& name, bool outgoing) {
+    QUrl url;
+    url.setScheme("attachment");
+    url.setPath(hash);
+    QUrlQuery query;
+    query.addQueryItem("name", name);
+    query.addQueryItem("size", QString::number(size));
+    url.setQuery(query);
+
+    QString link = QString("📎 <a href='%1'>%2</a> (%3 KB)")
+                   .arg(url.toString(QUrl::FullyEncoded), name.toHtmlEscaped())
+                   .arg((size + 1023) / 1024);
+    addChatMessage(from, link, outgoing);
+}
+
+void MainWindow::sendEphemeral(const QString& to, const QString& kind, bool active) {
+    if (!authenticated || !socket->isEncrypted() || to.isEmpty()) {
+        return;
+    }
+
+    sendMessage("EVENT:" + to + "|" + kind + "|" + (active ? "1" : "0"));
+    if (kind == "viewing" && active) {
+        viewingSentAt.restart();
+    }
+}
+
+void MainWindow::onMessageEdited(const QString& text) {
+    if (currentChat.isEmpty()) {
+        return;
+    }
+    if (text.isEmpty()) {
+        stopTyping();
+        return;
+    }
+
+    // Не надсилати подію на кожне натискання клавіші
+    if (typingTarget != currentChat || typingSentAt.elapsed() >= TYPING_RESEND_MS) {
+        typingTarget = currentChat;
+        typingSentAt.restart();
+        sendEphemeral(currentChat, "typing", true);
+    }
+    typingTimer->start();
+}
+
+void MainWindow::stopTyping() {
+    typingTimer->stop();
+    if (!typingTarget.isEmpty()) {
+        sendEphemeral(typingTarget, "typing", false);
+        typingTarget.clear();
+    }
+}
+
+void MainWindow::updateChatHeader() {
+    if (currentChat.isEmpty()) {
+        return;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QString header = "Chat with: " + currentChat;
+    if (typingUntil.value(currentChat) > now) {
+        header += " - typing...";
+    } else if (viewingUntil.value(currentChat) > now) {
+        header += " (viewing)";
+    }
+    ui->lblChatWith->setText(header);
 }
\ No newline at end of file
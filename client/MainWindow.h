@@ -2,15 +2,25 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <QTcpSocket>
+#include <QSslSocket>
+#include <QSslError>
 #include <QDateTime>
 #include <QVector>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QHash>
+#include <QSharedPointer>
+#include <QUrl>
+
+#include "DeliveryQueue.h"
 
 class QListWidgetItem;
 class QPushButton;
 class QLineEdit;
 class QTextEdit;
 class QListWidget;
+class QTimer;
+class QFile;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -24,6 +34,19 @@ struct ChatMessage {
     QDateTime timestamp;
 };
 
+// Передача вкладення (у будь-який бік)
+struct FileTransfer {
+    QString hash;      // SHA-256 вмісту - ідентифікатор файлу на сервері
+    QString name;
+    QString peer;      // Одержувач (відвантаження) або відправник (завантаження)
+    qint64 size = 0;
+    qint64 acked = 0;  // Відвантаження: прийнято сервером; завантаження: записано на диск
+    qint64 sent = 0;   // Відвантаження: відправлено в поточному з'єднанні
+    bool accepted = false;  // Відвантаження: сервер відповів на UPLOAD у поточному з'єднанні
+    QString path;      // Локальний файл (для завантаження - куди зберегти)
+    QSharedPointer<QFile> file;
+};
+
 class MainWindow : public QMainWindow {
     Q_OBJECT
 
@@ -39,6 +62,10 @@ private slots:
     void onDisconnected();
     void onReadyRead();
     void onError(QAbstractSocket::SocketError error);
+    void onSslErrors(const QList<QSslError>& errors);
+    void onNewSessionTicket();
+    void flushPendingWrites();
+    void onHeartbeatTimer();
 
     void onConnectClicked();
     void onRegisterClicked();
@@ -48,21 +75,72 @@ private slots:
     void onUserSelected(QListWidgetItem* item);
     void onCloneWindow();
     void onRefreshUsers();
+    void onAttachClicked();
+    void onAnchorClicked(const QUrl& url);
+    void onMessageEdited(const QString& text);
+    void stopTyping();
+    void updateChatHeader();
+    void retryAfterRateLimit();
 
 private:
     void sendMessage(const QString& msg);
+    void sendFrame(const QByteArray& payload);
     void addChatMessage(const QString& from, const QString& text, bool outgoing = false);
     void parseMessage(const QString& msg);
     void setupMenuBar();
+    void connectToServer(const QString& host, quint16 port);
     void storeChatMessage(const QString& otherUser, const QString& text, bool outgoing);
+    void resetDeliverySession();
+    void pumpOutgoing();
+    void updateDeliveryStatus();
+    void pumpUploads();
+    void resumeTransfers();
+    void requestUpload(FileTransfer& upload);
+    void handleFileChunk(const QByteArray& frame);
+    void finishDownload(const QString& hash);
+    void sendEphemeral(const QString& to, const QString& kind, bool active);
+    void addAttachmentMessage(const QString& from, const QString& hash, qint64 size,
+                              const QString& name, bool outgoing);
 
     Ui::MainWindow *ui;
-    QTcpSocket *socket;
+    QSslSocket *socket;
+    QString serverHost;  // "host:port" поточного сервера
+    QString lastAuthCommand;   // Останній REG/LOGIN - повторюється після REDIRECT
+    QString redirectCommand;   // Команда, яку треба відправити після перепідключення
+    QString redirectHost;
+    quint16 redirectPort = 0;
+    int redirectDelayMs = 0;   // Пауза перед перепідключенням (RECONNECT під час перезапуску сервера)
     QString username;
     QString currentChat;
     bool authenticated = false;
     bool isLoadingHistory = false;  // Флаг для відрізнення історії від нових повідомлень
     QByteArray receiveBuffer;  // Буфер для прийому повідомлень
+    QByteArray pendingWrite;   // Кадри, що будуть відправлені одним TLS-записом
+    bool flushScheduled = false;
+
+    // Heartbeat: виявлення "мертвого" з'єднання (сервер зник, мережа обірвалась)
+    QTimer *heartbeatTimer;
+    QElapsedTimer lastReceived;
+
+    // Доставка з номерами послідовності (див. DeliveryQueue)
+    QString clientId;                // Ідентифікатор сесії доставки
+    QString sessionUser;             // Користувач, для якого діє clientId
+    bool deliverySessionReady = false;
+    DeliveryQueue outgoing;
+    bool rateLimitRetryScheduled = false;  // Сервер відхилив частину команд - повтор запланований
+
+    // Вкладення: sha256 -> передача. Переживають перепідключення і продовжуються з останнього зсуву
+    QMap<QString, FileTransfer> uploads;
+    QMap<QString, FileTransfer> downloads;
+
+    // Ефемерні події (набір тексту, перегляд чату): не зберігаються і можуть губитися,
+    // тому стан співрозмовника має термін дії і періодично оновлюється
+    QTimer *typingTimer;
+    QString typingTarget;            // Кому зараз надіслано typing=1
+    QElapsedTimer typingSentAt;
+    QElapsedTimer viewingSentAt;
+    QHash<QString, qint64> typingUntil;   // username -> до якого часу (мс epoch) показувати
+    QHash<QString, qint64> viewingUntil;
 
     // Локальна історія повідомлень
     QVector<ChatMessage> chatHistory;
@@ -1,5 +1,7 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <afunix.h>
+#include <sddl.h>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -7,326 +9,2415 @@
 #include <thread>
 #include <mutex>
 #include <sstream>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <shared_mutex>
+#include <filesystem>
+#include <random>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "server/TimerWheel.h"
+#include "server/HashRing.h"
+#include "server/BlobStore.h"
+#include "server/CommandDispatcher.h"
+#include "server/TrafficLog.h"
 
 #pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Advapi32.lib")
+
+// Налаштування TLS
+const char* TLS_CERT_FILE = "server.crt";
+const char* TLS_KEY_FILE = "server.key";
+
+// Heartbeat: після HEARTBEAT_INTERVAL без вхідних даних сервер надсилає PING,
+// після HEARTBEAT_TIMEOUT з'єднання вважається мертвим і закривається
+const int TIMER_TICK_MS = 100;
+const uint64_t HEARTBEAT_INTERVAL_TICKS = 15 * 1000 / TIMER_TICK_MS;
+const uint64_t HEARTBEAT_TIMEOUT_TICKS = 45 * 1000 / TIMER_TICK_MS;
+
+// Скільки send() може чекати на клієнта, що не читає: потім з'єднання закривається
+const int CLIENT_SEND_TIMEOUT_MS = 5000;
+
+// Кластер: період повної розсилки статусів (anti-entropy) і затримка
+// об'єднання кількох оновлень статусу в одну розсилку списку користувачів
+const uint64_t PRESENCE_SYNC_TICKS = 10 * 1000 / TIMER_TICK_MS;
+const uint64_t USER_LIST_COALESCE_TICKS = 200 / TIMER_TICK_MS;
+const size_t PRESENCE_FRAME_LIMIT = 64 * 1024;
+
+// Скільки кадрів і вкладень накопичувати для недоступного вузла, перш ніж відкидати нові
+const size_t PEER_QUEUE_LIMIT = 64 * 1024 * 1024;
+const size_t MAX_PEER_BLOB_PUSHES = 4096;
+
+// Живучість каналів між вузлами: простій вихідного каналу заповнюється PING,
+// а читання чи запис, що стоять довше за PEER_TIMEOUT_MS, розривають з'єднання
+const int PEER_PING_INTERVAL_MS = 5000;
+const int PEER_TIMEOUT_MS = 15000;
+
+// Вкладення: пауза насоса передачі, коли всі сокети зайняті; як часто і після якого
+// простою видаляються недокачані файли (клієнт так і не завершив відвантаження)
+const int TRANSFER_IDLE_WAIT_MS = 5;
+const uint64_t PARTIAL_CLEANUP_TICKS = 60 * 60 * 1000 / TIMER_TICK_MS;
+const std::chrono::hours PARTIAL_UPLOAD_TTL(24);
+
+// Ефемерні події (набір тексту, перегляд чату): як часто розсилаються накопичені
+// оновлення і скільки одержувачів можна тримати в черзі, перш ніж нові події відкидаються
+const uint64_t EPHEMERAL_FLUSH_TICKS = 250 / TIMER_TICK_MS;
+const size_t MAX_EPHEMERAL_RECIPIENTS = 50000;
+const size_t EPHEMERAL_PEER_QUEUE_LIMIT = 256 * 1024;
+
+// З'єднання з однієї IP-адреси: скільки одночасно і як часто можна відкривати нові
+const int DEFAULT_MAX_CONNECTIONS_PER_IP = 64;
+const RateLimit CONNECTION_ACCEPT_RATE = {20, 5};
+const size_t MAX_TRACKED_IPS = 100000;
+
+// Плавна зупинка: скільки чекати, поки клієнти відключаться і черги до вузлів спорожніють,
+// і в якому діапазоні розкидати затримку перепідключення клієнтів
+const int DRAIN_TIMEOUT_MS = 5000;
+const int DRAIN_SEND_TIMEOUT_MS = 200;  // Клієнт, що не читає, не затримує розсилку RECONNECT
+const int DRAIN_PEER_TIMEOUT_MS = 1000;  // Закриття вхідних каналів і відправка останніх PACK
+const int RECONNECT_MIN_DELAY_MS = 200;
+const int RECONNECT_JITTER_MS = 3000;
+const char* STATE_FILE_MAGIC = "MESSENGER-STATE-1";
+const int TICKET_KEYS_SIZE = 80;  // Ключі шифрування session tickets (OpenSSL)
+
+// TLS-з'єднання з клієнтом.
+// SSL працює через memory BIO: потік клієнта сам читає сокет і віддає байти в rbio,
+// а зашифровані записи забираються з wbio і відправляються одним send().
+// Так один SSL-об'єкт можна безпечно використовувати з різних потоків під ioMutex,
+// і recv() ніколи не блокується з захопленим м'ютексом.
+struct Connection {
+    SOCKET socket = INVALID_SOCKET;
+    SSL* ssl = nullptr;
+    BIO* rbio = nullptr;        // Вхідні зашифровані байти (сокет -> SSL)
+    BIO* wbio = nullptr;        // Вихідні зашифровані байти (SSL -> сокет)
+    std::mutex ioMutex;
+    std::string outBuffer;      // Кадри, що чекають на flushClient()
+
+    // Закриття не чекає на ioMutex: його може тримати потік, що застряг у send().
+    // closeMutex захищає лише shutdown()/closesocket() і ніколи не тримається під час вводу-виводу.
+    std::atomic<bool> closed{false};
+    std::mutex closeMutex;
+    bool socketReleased = false;  // closesocket() вже викликано (під closeMutex)
+
+    std::atomic<uint64_t> lastActivityTick{0};  // Тік останніх отриманих даних
+    uint64_t pingSentTick = 0;                  // Змінюється лише в потоці таймерів
+
+    // Активні завантаження файлів клієнтом (під ioMutex), обслуговуються transferPumpLoop
+    struct Download {
+        std::string hash;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        std::unique_ptr<std::ifstream> file;
+    };
+    std::deque<Download> downloads;
+
+    ~Connection() {
+        if (ssl) SSL_free(ssl);  // Звільняє також rbio і wbio
+    }
+};
+
+// Вузол кластера
+struct ClusterNode {
+    int id = 0;
+    std::string host;
+    int clientPort = 0;   // Порт для клієнтів (для REDIRECT)
+    int clusterPort = 0;  // Порт для з'єднань між вузлами
+};
+
+// Вихідний канал до іншого вузла.
+// Кадри накопичуються в queue, окремий потік відправляє все накопичене одним send(),
+// не чекаючи підтверджень (pipelining) - тому під навантаженням пакети великі.
+// Відправлені кадри нумеруються і лежать в inFlight, поки вузол не підтвердить (PACK),
+// що обробив їх; після обриву вони відправляються повторно з тими самими номерами,
+// а вузол відкидає вже оброблені. Так кадр не губиться, якщо вузол перезапускається
+// і не встиг зберегти його в стані, і не дублюється, якщо встиг.
+struct PeerLink {
+    // Вкладення, яке треба скопіювати на вузол одержувача перед кадром followUp
+    struct BlobPush {
+        std::string hash;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        std::string followUp;
+    };
+
+    ClusterNode node;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string queue;           // Ще не відправлені кадри
+    std::string inFlight;        // Відправлені, але ще не підтверджені кадри
+    uint64_t inFlightFirst = 1;  // Номер першого кадру inFlight
+    size_t inFlightCount = 0;
+    std::string ack;             // Останнє PACK для цього вузла; поза нумерацією кадрів
+    std::deque<BlobPush> blobs;  // Передаються по одному шматку за відправку, між кадрами чату
+    bool overflowing = false;    // Черга переповнена - про відкинуті кадри вже повідомлено
+};
+
+// З'єднання з однієї IP-адреси
+struct IpState {
+    int connections = 0;
+    TokenBucket accepts{CONNECTION_ACCEPT_RATE.burst, CONNECTION_ACCEPT_RATE.perSecond};
+};
+
+// Глобальні дані
+ChatStore g_chat;   // Користувачі, історія, права на вкладення
+std::mutex g_mutex;
+
+std::map<SOCKET, std::shared_ptr<Connection>> g_connections;  // socket -> TLS-з'єднання
+std::mutex g_connMutex;
+SSL_CTX* g_sslCtx = nullptr;
+
+// Вкладення
+BlobStore g_blobs;
+std::vector<std::weak_ptr<Connection>> g_transferConnections;  // З'єднання з активними завантаженнями
+std::mutex g_transferMutex;
+std::condition_variable g_transferCv;
+
+// Ефемерні події не проходять через g_mutex: одержувача шукаємо в окремому
+// індексі онлайн-користувачів під shared_mutex (переважно читання)
+std::map<std::string, SOCKET> g_onlineIndex;   // username -> socket локальних онлайн-користувачів
+std::shared_mutex g_onlineIndexMutex;
+
+// Накопичені події: одержувач -> ("відправник|тип" -> значення). Нове значення
+// замінює старе, тому за період розсилки до одержувача йде лише останній стан.
+std::map<std::string, std::map<std::string, std::string>> g_ephemeralPending;
+std::mutex g_ephemeralMutex;
+bool g_ephemeralFlushScheduled = false;
+
+// Ліміти з'єднань за IP-адресою (ліміти команд - у CommandDispatcher)
+std::map<std::string, IpState> g_ipStates;         // IP-адреса -> з'єднання
+std::mutex g_ipMutex;
+int g_maxConnectionsPerIp = DEFAULT_MAX_CONNECTIONS_PER_IP;
+
+// Налаштування кластера (g_nodeId == 0 - кластер вимкнено)
+int g_nodeId = 0;
+int g_clientPort = 12345;
+int g_clusterPort = 0;
+std::string g_clusterSecret;
+SSL_CTX* g_peerServerCtx = nullptr;                      // TLS між вузлами (PSK з секрету кластера)
+SSL_CTX* g_peerClientCtx = nullptr;
+unsigned char g_clusterKey[32];
+std::map<int, ClusterNode> g_nodes;                      // Інші вузли кластера
+std::map<int, std::unique_ptr<PeerLink>> g_peerLinks;   // nodeId -> вихідний канал
+HashRing g_ring;
+std::map<std::string, RemoteUser> g_remoteUsers;         // Захищено g_mutex
+
+// Нумерація кадрів між вузлами. Епоха - випадкове число процесу: після перезапуску
+// вузла-відправника номери починаються заново, і одержувач бачить це за новою епохою.
+// Для кожного вузла-відправника пам'ятаємо останній оброблений номер (зберігається в стані).
+struct PeerInbound {
+    uint64_t epoch = 0;
+    uint64_t lastSeq = 0;
+    SOCKET connection = INVALID_SOCKET;  // Поточне вхідне з'єднання вузла (не зберігається)
+};
+uint64_t g_peerEpoch = 0;
+std::map<int, PeerInbound> g_peerInbound;
+std::mutex g_peerInboundMutex;
+
+// Вхідні з'єднання вузлів: drain закриває їх перед збереженням стану
+std::set<SOCKET> g_peerSockets;
+bool g_peerInboundClosed = false;
+std::mutex g_peerSocketsMutex;
+std::condition_variable g_peerSocketsCv;
+std::atomic<bool> g_userListBroadcastPending{false};
+
+// Зупинка і гарячий перезапуск. Слухаючі сокети атомарні, бо їх закриває
+// обробник Ctrl+C або потік керування, поки головний потік чекає в accept()
+std::atomic<bool> g_shuttingDown{false};
+std::atomic<SOCKET> g_listenSocket{INVALID_SOCKET};
+std::atomic<SOCKET> g_clusterListenSocket{INVALID_SOCKET};
+SOCKET g_controlSocket = INVALID_SOCKET;               // AF_UNIX, сюди підключається --takeover
+std::atomic<SOCKET> g_takeoverSocket{INVALID_SOCKET};  // Нова версія, що чекає на READY
+bool g_takeover = false;                               // Запущено з --takeover
+std::mutex g_shutdownMutex;
+std::condition_variable g_shutdownCv;
+bool g_drained = false;
+
+// Один потік таймерів на всі з'єднання замість окремого watchdog на кожне
+TimerWheel g_timers;
+std::mutex g_timerMutex;
+
+// Робота, яку таймери ставлять у чергу: сам потік таймерів ніколи не пише в сокети
+// і не чекає на ioMutex, тому клієнт, що не читає, не зупиняє heartbeat інших
+std::deque<std::function<void()>> g_workQueue;
+std::mutex g_workMutex;
+std::condition_variable g_workCv;
+const auto g_startTime = std::chrono::steady_clock::now();
+
+uint64_t currentMillis() {
+    auto elapsed = std::chrono::steady_clock::now() - g_startTime;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+// Запис трафіку (--record FILE) для відтворення в server_tests, формат - server/TrafficLog.h.
+// Пишуться кадри клієнтів і все, що сервер ставить у чергу з потоків клієнтів під час
+// обробки команд. Кадри з фонових потоків (PING, EVENTS, FILE_CHUNK, кластер) не пишуться.
+// Під час запису команди обробляються по одній (g_recordDispatchMutex), щоб запис
+// відтворювався в тому ж порядку.
+std::atomic<bool> g_recording{false};
+std::ofstream g_recordFile;
+std::mutex g_recordMutex;
+std::mutex g_recordDispatchMutex;
+std::map<SOCKET, int> g_recordIds;       // socket -> номер з'єднання в записі
+int g_recordNextId = 1;
+uint64_t g_recordLastMillis = ~0ull;
+thread_local bool t_recordReplies = false;  // Потік клієнта: записувати вихідні кадри
+
+void recordEvent(SOCKET s, const char* marker, const std::string& frame = std::string()) {
+    std::lock_guard<std::mutex> lock(g_recordMutex);
+
+    uint64_t now = currentMillis();
+    if (now != g_recordLastMillis) {
+        g_recordFile << "@ " << now << '\n';
+        g_recordLastMillis = now;
+    }
+
+    auto it = g_recordIds.find(s);
+    if (it == g_recordIds.end()) {
+        it = g_recordIds.emplace(s, g_recordNextId++).first;
+    }
+    g_recordFile << it->second << marker << escapeFrame(frame) << '\n';
+
+    if (std::strcmp(marker, " close") == 0) {
+        g_recordIds.erase(it);
+        g_recordFile.flush();
+    }
+}
+
+uint64_t currentTick() {
+    return currentMillis() / TIMER_TICK_MS;
+}
+
+TimerWheel::TimerId scheduleTimer(uint64_t delayTicks, TimerWheel::Callback callback) {
+    std::lock_guard<std::mutex> lock(g_timerMutex);
+    return g_timers.schedule(delayTicks, std::move(callback));
+}
+
+void postWork(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(g_workMutex);
+    g_workQueue.push_back(std::move(task));
+    g_workCv.notify_one();
+}
+
+// Потік фонової роботи: розсилки, запущені таймерами. Блокування тут обмежене CLIENT_SEND_TIMEOUT_MS.
+void workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(g_workMutex);
+            g_workCv.wait(lock, []() { return !g_workQueue.empty(); });
+            task = std::move(g_workQueue.front());
+            g_workQueue.pop_front();
+        }
+        task();
+    }
+}
+
+// Потік таймерів: просуває колесо раз на тік і виконує callbacks без g_timerMutex.
+// Callbacks лише ставлять роботу в чергу (postWork) або закривають з'єднання - без вводу-виводу.
+void timerLoop() {
+    std::vector<TimerWheel::Callback> expired;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(TIMER_TICK_MS));
+
+        {
+            std::lock_guard<std::mutex> lock(g_timerMutex);
+            g_timers.advance(currentTick() + 1, expired);
+        }
+
+        for (auto& callback : expired) {
+            callback();
+        }
+        expired.clear();
+    }
+}
+
+void printTlsErrors(const char* context) {
+    unsigned long err;
+    while ((err = ERR_get_error()) != 0) {
+        char buf[256];
+        ERR_error_string_n(err, buf, sizeof(buf));
+        std::cout << "[TLS] " << context << ": " << buf << std::endl;
+    }
+}
+
+// Записати приватні дані (ключ TLS, файл стану) у новий файл, доступний лише обліковому запису сервера.
+// Файл видаляється і створюється заново: права існуючого файлу при перезаписі не змінюються.
+bool writePrivateFile(const char* path, const char* data, size_t length) {
+    // DACL без успадкування: повний доступ лише власнику (OW) і SYSTEM
+    SECURITY_ATTRIBUTES attributes = {sizeof(attributes), nullptr, FALSE};
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA("D:P(A;;FA;;;OW)(A;;FA;;;SY)", SDDL_REVISION_1,
+                                                              &attributes.lpSecurityDescriptor, nullptr)) {
+        return false;
+    }
+    DeleteFileA(path);
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, &attributes, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LocalFree(attributes.lpSecurityDescriptor);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    DWORD written = 0;
+    bool ok = WriteFile(file, data, (DWORD)length, &written, nullptr) && written == length;
+    CloseHandle(file);
+    return ok;
+}
+
+// Згенерувати самопідписаний сертифікат (ECDSA P-256), якщо server.crt/server.key відсутні.
+// Файл server.crt потрібно покласти поруч з клієнтом - він використовується для pinning.
+bool generateSelfSignedCertificate() {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    if (!key || !cert) {
+        EVP_PKEY_free(key);
+        X509_free(cert);
+        return false;
+    }
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), (long)time(nullptr));
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 60L * 60 * 24 * 365 * 5);
+    X509_set_pubkey(cert, key);
+
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"Corporate Messenger", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+
+    X509V3_CTX v3ctx;
+    X509V3_set_ctx_nodb(&v3ctx);
+    X509V3_set_ctx(&v3ctx, cert, cert, nullptr, nullptr, 0);
+    X509_EXTENSION* san = X509V3_EXT_conf_nid(nullptr, &v3ctx, NID_subject_alt_name,
+                                              "DNS:localhost,IP:127.0.0.1");
+    if (san) {
+        X509_add_ext(cert, san, -1);
+        X509_EXTENSION_free(san);
+    }
+
+    bool ok = X509_sign(cert, key, EVP_sha256()) > 0;
+
+    if (ok) {
+        // Ключ спершу серіалізується в пам'ять, щоб файл одразу створити з обмеженими правами
+        BIO* certBio = BIO_new_file(TLS_CERT_FILE, "w");
+        BIO* keyBio = BIO_new(BIO_s_mem());
+        ok = certBio && keyBio &&
+             PEM_write_bio_X509(certBio, cert) &&
+             PEM_write_bio_PrivateKey(keyBio, key, nullptr, nullptr, 0, nullptr, nullptr);
+        if (ok) {
+            char* pem = nullptr;
+            long pemLength = BIO_get_mem_data(keyBio, &pem);
+            ok = writePrivateFile(TLS_KEY_FILE, pem, (size_t)pemLength);
+        }
+        BIO_free(certBio);
+        BIO_free_all(keyBio);
+    }
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+// Ініціалізація TLS-контексту сервера
+bool initTls() {
+    g_sslCtx = SSL_CTX_new(TLS_server_method());
+    if (!g_sslCtx) {
+        printTlsErrors("SSL_CTX_new");
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(g_sslCtx, TLS1_2_VERSION);
+
+    // Лише AEAD-шифри з апаратним прискоренням (AES-NI) або ChaCha20 для клієнтів без нього.
+    // PRIORITIZE_CHACHA вибирає ChaCha20 тільки якщо клієнт сам ставить його першим.
+    SSL_CTX_set_ciphersuites(g_sslCtx, "TLS_AES_128_GCM_SHA256:TLS_CHACHA20_POLY1305_SHA256:TLS_AES_256_GCM_SHA384");
+    SSL_CTX_set_cipher_list(g_sslCtx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_options(g_sslCtx, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA |
+                                  SSL_OP_NO_RENEGOTIATION);
+
+    // Відновлення сесій: кеш на сервері (TLS 1.2) + session tickets (TLS 1.2/1.3),
+    // щоб масове перепідключення клієнтів не вимагало повного handshake
+    static const unsigned char sessionContext[] = "corporate-messenger";
+    SSL_CTX_set_session_id_context(g_sslCtx, sessionContext, sizeof(sessionContext) - 1);
+    SSL_CTX_set_session_cache_mode(g_sslCtx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(g_sslCtx, 20000);
+    SSL_CTX_set_timeout(g_sslCtx, 60 * 60 * 24);
+    SSL_CTX_set_num_tickets(g_sslCtx, 1);
+
+    // Звільняти буфери SSL для неактивних з'єднань
+    SSL_CTX_set_mode(g_sslCtx, SSL_MODE_RELEASE_BUFFERS);
+
+    FILE* existing = fopen(TLS_CERT_FILE, "r");
+    if (existing) {
+        fclose(existing);
+    } else {
+        std::cout << "[TLS] " << TLS_CERT_FILE << " not found, generating self-signed certificate" << std::endl;
+        if (!generateSelfSignedCertificate()) {
+            printTlsErrors("generate certificate");
+            return false;
+        }
+    }
+
+    if (SSL_CTX_use_certificate_chain_file(g_sslCtx, TLS_CERT_FILE) != 1 ||
+        SSL_CTX_use_PrivateKey_file(g_sslCtx, TLS_KEY_FILE, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(g_sslCtx) != 1) {
+        printTlsErrors("load certificate");
+        return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<Connection> findConnection(SOCKET clientSocket) {
+    std::lock_guard<std::mutex> lock(g_connMutex);
+    auto it = g_connections.find(clientSocket);
+    if (it == g_connections.end()) return nullptr;
+    return it->second;
+}
+
+// Відправити в сокет усі зашифровані байти з wbio (викликати під conn.ioMutex)
+bool drainTlsOutput(Connection& conn) {
+    char chunk[16384];
+    int pending;
+    while ((pending = BIO_read(conn.wbio, chunk, sizeof(chunk))) > 0) {
+        int sent = 0;
+        while (sent < pending) {
+            int n = send(conn.socket, chunk + sent, pending - sent, 0);
+            if (n <= 0) return false;
+            sent += n;
+        }
+    }
+    return true;
+}
+
+// Передати отримані з сокета байти в TLS і дописати розшифровані дані в inbox.
+// Тут же відбувається handshake - відповіді сервера одразу відправляються клієнту.
+bool tlsReceive(Connection& conn, const char* data, int length, std::string& inbox) {
+    std::lock_guard<std::mutex> lock(conn.ioMutex);
+
+    if (BIO_write(conn.rbio, data, length) != length) {
+        return false;
+    }
+
+    char plain[16384];
+    while (true) {
+        int n = SSL_read(conn.ssl, plain, sizeof(plain));
+        if (n > 0) {
+            inbox.append(plain, n);
+            continue;
+        }
+
+        int err = SSL_get_error(conn.ssl, n);
+        if (err == SSL_ERROR_WANT_READ) {
+            break;
+        }
+        if (err != SSL_ERROR_ZERO_RETURN) {
+            printTlsErrors("SSL_read");
+        }
+        drainTlsOutput(conn);
+        return false;
+    }
+
+    return drainTlsOutput(conn);
+}
+
+// Поставити кадр у вихідну чергу клієнта.
+// Нічого не відправляє - кадри накопичуються до flushClient(), щоб
+// кілька дрібних відповідей пішли одним TLS-записом замість запису на кожен кадр.
+void sendToClient(SOCKET clientSocket, const std::string& msg) {
+    std::shared_ptr<Connection> conn = findConnection(clientSocket);
+    if (!conn) return;
+
+    {
+        std::lock_guard<std::mutex> lock(conn->ioMutex);
+        if (conn->closed) return;
+        appendFrame(conn->outBuffer, msg);
+    }
+    if (t_recordReplies && g_recording) recordEvent(clientSocket, "< ", msg);
+    std::cout << "[Server -> Client] " << msg.substr(0, 50) << std::endl;
+}
+
+// Закрити з'єднання з будь-якого потоку: після цього кадри більше не відправляються,
+// а потік клієнта отримає помилку recv() і сам прибере сесію
+void closeConnection(Connection& conn) {
+    std::lock_guard<std::mutex> lock(conn.closeMutex);
+    conn.closed = true;
+    if (!conn.socketReleased) shutdown(conn.socket, SD_BOTH);
+}
+
+// Запис у з'єднання не вдався (зокрема через CLIENT_SEND_TIMEOUT_MS): частину кадрів
+// уже втрачено, тож продовжувати потік не можна (викликати під conn.ioMutex)
+void abortConnectionLocked(Connection& conn) {
+    conn.outBuffer.clear();
+    closeConnection(conn);
+}
+
+// Зашифрувати і відправити все накопичене одним SSL_write (викликати під conn.ioMutex)
+void flushLocked(Connection& conn) {
+    if (conn.closed || conn.outBuffer.empty() || !SSL_is_init_finished(conn.ssl)) return;
+
+    int written = SSL_write(conn.ssl, conn.outBuffer.data(), (int)conn.outBuffer.size());
+    if (written <= 0) {
+        printTlsErrors("SSL_write");
+        abortConnectionLocked(conn);
+        return;
+    }
+    conn.outBuffer.clear();
+
+    if (!drainTlsOutput(conn)) {
+        abortConnectionLocked(conn);
+    }
+}
+
+void flushClient(SOCKET clientSocket) {
+    std::shared_ptr<Connection> conn = findConnection(clientSocket);
+    if (!conn) return;
+
+    std::lock_guard<std::mutex> lock(conn->ioMutex);
+    flushLocked(*conn);
+}
+
+// Чи можна писати в сокет без блокування (є місце в буфері відправки ядра)
+bool socketWritable(SOCKET s) {
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(s, &writeSet);
+    timeval timeout = {0, 0};
+    return select((int)s + 1, NULL, &writeSet, NULL, &timeout) > 0;
+}
+
+// Поставити в чергу і відправити наступний шматок одного із завантажень з'єднання.
+// Шматок читається з файлу одразу в кінець вихідного буфера, без окремого буфера
+// для шматка; далі він, як і кадри чату, копіюється в SSL_write при шифруванні.
+// Повертає false, якщо завантажень більше немає.
+bool sendNextFileChunk(Connection& conn) {
+    std::lock_guard<std::mutex> lock(conn.ioMutex);
+    if (conn.closed || conn.downloads.empty()) return false;
+
+    Connection::Download& d = conn.downloads.front();
+    uint64_t length = std::min<uint64_t>(BlobStore::CHUNK_SIZE, d.size - d.offset);
+
+    std::string header = "FILE_CHUNK:" + d.hash + "|" + std::to_string(d.offset) + "|";
+    size_t frameStart = conn.outBuffer.size();
+    appendFrameHeader(conn.outBuffer, header.size() + (size_t)length);
+    conn.outBuffer += header;
+
+    size_t dataPos = conn.outBuffer.size();
+    conn.outBuffer.resize(dataPos + (size_t)length);
+    d.file->read(&conn.outBuffer[dataPos], (std::streamsize)length);
+    if (!*d.file) {
+        // Файл пошкоджено або зник - прибрати недописаний кадр
+        conn.outBuffer.resize(frameStart);
+        conn.downloads.pop_front();
+        return true;
+    }
+    d.offset += length;
+
+    // Кілька файлів одного клієнта чергуються по шматку
+    Connection::Download current = std::move(conn.downloads.front());
+    conn.downloads.pop_front();
+    if (current.offset < current.size) {
+        conn.downloads.push_back(std::move(current));
+    }
+
+    flushLocked(conn);
+    return true;
+}
+
+// Насос передачі файлів: по черзі надсилає по одному шматку кожному з'єднанню.
+// Між шматками в те саме з'єднання проходять кадри чату, тому великий файл
+// не затримує повідомлення більше ніж на один шматок.
+void transferPumpLoop() {
+    while (true) {
+        std::vector<std::shared_ptr<Connection>> active;
+        {
+            std::unique_lock<std::mutex> lock(g_transferMutex);
+            g_transferCv.wait(lock, []() { return !g_transferConnections.empty(); });
+
+            for (auto it = g_transferConnections.begin(); it != g_transferConnections.end();) {
+                std::shared_ptr<Connection> conn = it->lock();
+                if (conn) {
+                    active.push_back(conn);
+                    ++it;
+                } else {
+                    it = g_transferConnections.erase(it);
+                }
+            }
+        }
+
+        bool progress = false;
+        for (auto& conn : active) {
+            if (!socketWritable(conn->socket)) continue;
+
+            if (sendNextFileChunk(*conn)) {
+                progress = true;
+                continue;
+            }
+
+            // Завантажень не лишилось - прибрати з'єднання з активних
+            std::lock_guard<std::mutex> lock(g_transferMutex);
+            for (auto it = g_transferConnections.begin(); it != g_transferConnections.end(); ++it) {
+                if (it->lock() == conn) {
+                    g_transferConnections.erase(it);
+                    break;
+                }
+            }
+        }
+
+        if (!progress) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(TRANSFER_IDLE_WAIT_MS));
+        }
+    }
+}
+
+// Періодичне прибирання покинутих відвантажень у tmp/ сховища
+void cleanupPartialUploads() {
+    size_t removed = g_blobs.removeStalePartials(PARTIAL_UPLOAD_TTL);
+    if (removed > 0) {
+        std::cout << "[File] Removed " << removed << " abandoned partial uploads" << std::endl;
+    }
+    scheduleTimer(PARTIAL_CLEANUP_TICKS, []() { postWork(cleanupPartialUploads); });
+}
+
+// Додати завантаження файлу клієнту з позиції offset
+bool startDownload(SOCKET clientSocket, const std::string& hash, uint64_t offset) {
+    std::shared_ptr<Connection> conn = findConnection(clientSocket);
+    if (!conn) return false;
+
+    Connection::Download d;
+    d.hash = hash;
+    d.size = g_blobs.size(hash);
+    d.offset = offset;
+    d.file = std::make_unique<std::ifstream>(g_blobs.path(hash), std::ios::binary);
+    if (!*d.file || offset > d.size) return false;
+    d.file->seekg((std::streamoff)offset);
+    bool complete = offset == d.size;
+
+    bool wasIdle;
+    {
+        std::lock_guard<std::mutex> lock(conn->ioMutex);
+        wasIdle = conn->downloads.empty();
+        for (auto it = conn->downloads.begin(); it != conn->downloads.end(); ++it) {
+            if (it->hash == hash) {
+                conn->downloads.erase(it);
+                break;
+            }
+        }
+        if (!complete) {
+            conn->downloads.push_back(std::move(d));
+        }
+    }
+
+    // У клієнта вже всі байти (повний .part від попередньої спроби): порожній останній
+    // шматок, щоб клієнт перевірив файл і завершив завантаження, а не чекав на дані
+    if (complete) {
+        sendToClient(clientSocket, "FILE_CHUNK:" + hash + "|" + std::to_string(offset) + "|");
+        return true;
+    }
+
+    if (wasIdle) {
+        std::lock_guard<std::mutex> lock(g_transferMutex);
+        g_transferConnections.push_back(conn);
+        g_transferCv.notify_one();
+    }
+    return true;
+}
+
+// Перевірка активності з'єднання. Таймер не переставляється на кожен recv():
+// потік клієнта лише оновлює lastActivityTick, а при спрацюванні таймер
+// сам обчислює, коли перевіряти наступного разу.
+void checkHeartbeat(std::weak_ptr<Connection> weakConn) {
+    std::shared_ptr<Connection> conn = weakConn.lock();
+    if (!conn) return;
+
+    uint64_t now = currentTick();
+    uint64_t lastActivity = conn->lastActivityTick.load();
+    uint64_t idle = now > lastActivity ? now - lastActivity : 0;
+
+    if (idle >= HEARTBEAT_TIMEOUT_TICKS) {
+        // Напіввідкрите з'єднання: розблокувати recv() у потоці клієнта,
+        // він сам прибере сесію і оновить статус користувача
+        if (!conn->closed) {
+            std::cout << "[Server] Heartbeat timeout, closing connection" << std::endl;
+            closeConnection(*conn);
+        }
+        return;
+    }
+
+    uint64_t nextCheck;
+    if (idle >= HEARTBEAT_INTERVAL_TICKS) {
+        if (conn->pingSentTick <= lastActivity) {
+            conn->pingSentTick = now;
+            postWork([weakConn]() {
+                std::shared_ptr<Connection> target = weakConn.lock();
+                if (!target) return;
+                sendToClient(target->socket, "PING");
+                flushClient(target->socket);
+            });
+        }
+        nextCheck = HEARTBEAT_TIMEOUT_TICKS - idle;
+    } else {
+        nextCheck = HEARTBEAT_INTERVAL_TICKS - idle;
+    }
+
+    scheduleTimer(nextCheck, [weakConn]() { checkHeartbeat(weakConn); });
+}
+
+bool isClusterEnabled() {
+    return g_nodeId != 0;
+}
+
+// Вузол, якому належить користувач
+int ownerNode(const std::string& username) {
+    if (!isClusterEnabled()) return g_nodeId;
+    return g_ring.ownerOf(username);
+}
+
+// Поставити кадр у чергу до вузла (без очікування відправки)
+void sendToPeer(int nodeId, const std::string& msg) {
+    auto it = g_peerLinks.find(nodeId);
+    if (it == g_peerLinks.end()) return;
+
+    PeerLink& link = *it->second;
+    {
+        std::lock_guard<std::mutex> lock(link.mutex);
+        if (link.queue.size() + link.inFlight.size() + msg.size() > PEER_QUEUE_LIMIT) {
+            if (!link.overflowing) {
+                std::cout << "[Cluster] Queue to node " << nodeId << " is full, dropping frames" << std::endl;
+                link.overflowing = true;
+            }
+            return;
+        }
+        link.overflowing = false;
+        appendFrame(link.queue, msg);
+    }
+    link.cv.notify_one();
+}
+
+void sendToAllPeers(const std::string& msg) {
+    for (const auto& pair : g_peerLinks) {
+        sendToPeer(pair.first, msg);
+    }
+}
+
+// Рядок статусу локального користувача для gossip: "username|department|online"
+std::string presenceLine(const User& u) {
+    return u.username + "|" + u.department + "|" + (u.online ? "1" : "0");
+}
+
+// Розіслати зміну статусу локального користувача (викликати під g_mutex)
+void gossipPresenceLocked(const User& u) {
+    if (isClusterEnabled()) {
+        sendToAllPeers("PRESENCE:" + presenceLine(u));
+    }
+}
+
+// Повний знімок статусів локальних користувачів, розбитий на кадри до PRESENCE_FRAME_LIMIT
+std::vector<std::string> presenceSnapshot() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    std::vector<std::string> frames;
+    std::string frame = "PRESENCE:";
+    for (const auto& pair : g_chat.users) {
+        if (frame.size() > PRESENCE_FRAME_LIMIT) {
+            frames.push_back(frame);
+            frame = "PRESENCE:";
+        }
+        if (frame.size() > 9) frame += "\n";
+        frame += presenceLine(pair.second);
+    }
+    if (frame.size() > 9) frames.push_back(frame);
+    return frames;
+}
+
+SOCKET connectToPeer(const ClusterNode& node) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* result = nullptr;
+    std::string port = std::to_string(node.clusterPort);
+    if (getaddrinfo(node.host.c_str(), port.c_str(), &hints, &result) != 0) {
+        return INVALID_SOCKET;
+    }
+
+    SOCKET s = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (s != INVALID_SOCKET && connect(s, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR) {
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+
+    if (s != INVALID_SOCKET) {
+        // Пакетуванням займаємось самі - Nagle лише додав би затримку
+        int flag = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+
+        // Вузол, що перестав читати, не блокує потік відправки назавжди
+        DWORD sendTimeout = PEER_TIMEOUT_MS;
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
+    }
+    return s;
+}
+
+bool sendAll(SOCKET s, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(s, data.data() + sent, (int)(data.size() - sent), 0);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Відправити все через TLS-канал до вузла; sent - скільки байтів пішло до помилки
+// (SSL_MODE_ENABLE_PARTIAL_WRITE: SSL_write повертає кількість після кожного запису)
+bool sendAllTls(SSL* ssl, const std::string& data, size_t& sent) {
+    sent = 0;
+    while (sent < data.size()) {
+        int n = SSL_write(ssl, data.data() + sent, (int)std::min<size_t>(data.size() - sent, INT_MAX));
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Довжина перших count кадрів пачки (count == SIZE_MAX - усіх); frames - скільки їх насправді
+size_t framesLength(const std::string& batch, size_t count, size_t* frames = nullptr) {
+    size_t pos = 0, n = 0;
+    while (pos < batch.size() && n < count) {
+        size_t colon = batch.find(':', pos);
+        if (colon == std::string::npos) break;
+        pos = colon + 1 + (size_t)strtoull(batch.c_str() + pos, nullptr, 10);
+        n++;
+    }
+    if (frames) *frames = n;
+    return std::min(pos, batch.size());
+}
+
+// Запам'ятати в inFlight пачку, що зараз піде вузлу (викликати під link.mutex)
+void addInFlightLocked(PeerLink& link, const std::string& batch) {
+    size_t frames = 0;
+    framesLength(batch, SIZE_MAX, &frames);
+    link.inFlight += batch;
+    link.inFlightCount += frames;
+}
+
+// PACK:epoch|seq від вузла: кадри до seq включно оброблені, повторювати їх не треба
+void acknowledgePeerFrames(int peerId, const std::string& data) {
+    size_t pos = data.find('|', 5);
+    if (pos == std::string::npos) return;
+    uint64_t epoch = strtoull(data.c_str() + 5, nullptr, 10);
+    uint64_t seq = strtoull(data.c_str() + pos + 1, nullptr, 10);
+
+    auto it = g_peerLinks.find(peerId);
+    if (epoch != g_peerEpoch || it == g_peerLinks.end()) return;
+
+    PeerLink& link = *it->second;
+    std::lock_guard<std::mutex> lock(link.mutex);
+    if (seq < link.inFlightFirst) return;
+
+    size_t count = (size_t)std::min<uint64_t>(seq - link.inFlightFirst + 1, link.inFlightCount);
+    link.inFlight.erase(0, framesLength(link.inFlight, count));
+    link.inFlightFirst += count;
+    link.inFlightCount -= count;
+}
+
+// Підтвердити вузлу оброблені кадри; PACK не нумерується, тож на нього не відповідають
+void queuePeerAck(int peerId, uint64_t epoch, uint64_t lastSeq) {
+    auto it = g_peerLinks.find(peerId);
+    if (it == g_peerLinks.end()) return;
+
+    PeerLink& link = *it->second;
+    {
+        std::lock_guard<std::mutex> lock(link.mutex);
+        link.ack.clear();
+        appendFrame(link.ack, "PACK:" + std::to_string(epoch) + "|" + std::to_string(lastSeq));
+    }
+    link.cv.notify_one();
+}
+
+// Ідентичність PSK вузла: "node-<id>"
+std::string peerIdentity(int nodeId) {
+    return "node-" + std::to_string(nodeId);
+}
+
+int peerNodeFromIdentity(const char* identity) {
+    if (!identity || std::strncmp(identity, "node-", 5) != 0) return 0;
+    int nodeId = atoi(identity + 5);
+    return peerIdentity(nodeId) == identity && g_nodes.count(nodeId) ? nodeId : 0;
+}
+
+// Вузол з ідентичності запам'ятовується в app data: у TLS 1.3 SSL_get_psk_identity на сервері порожній
+unsigned int peerPskServerCallback(SSL* ssl, const char* identity, unsigned char* psk, unsigned int maxPskLength) {
+    int nodeId = peerNodeFromIdentity(identity);
+    if (nodeId == 0 || maxPskLength < sizeof(g_clusterKey)) return 0;
+    SSL_set_app_data(ssl, (void*)(intptr_t)nodeId);
+    memcpy(psk, g_clusterKey, sizeof(g_clusterKey));
+    return sizeof(g_clusterKey);
+}
+
+unsigned int peerPskClientCallback(SSL*, const char*, char* identity, unsigned int maxIdentityLength,
+                                   unsigned char* psk, unsigned int maxPskLength) {
+    std::string own = peerIdentity(g_nodeId);
+    if (own.size() + 1 > maxIdentityLength || maxPskLength < sizeof(g_clusterKey)) return 0;
+    memcpy(identity, own.c_str(), own.size() + 1);
+    memcpy(psk, g_clusterKey, sizeof(g_clusterKey));
+    return sizeof(g_clusterKey);
+}
+
+// TLS 1.3 між вузлами з ключем PSK = SHA-256(секрет кластера): вузли автентифікують
+// один одного без сертифікатів, секрет не передається, кадри чату зашифровані.
+// Невідома ідентичність або інший секрет - handshake не вдається.
+bool initClusterTls() {
+    unsigned int keyLength = 0;
+    EVP_Digest(g_clusterSecret.data(), g_clusterSecret.size(), g_clusterKey, &keyLength, EVP_sha256(), nullptr);
+
+    g_peerServerCtx = SSL_CTX_new(TLS_server_method());
+    g_peerClientCtx = SSL_CTX_new(TLS_client_method());
+    if (!g_peerServerCtx || !g_peerClientCtx) {
+        printTlsErrors("cluster SSL_CTX_new");
+        return false;
+    }
+
+    for (SSL_CTX* ctx : {g_peerServerCtx, g_peerClientCtx}) {
+        SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+        SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_CHACHA20_POLY1305_SHA256");
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_AUTO_RETRY);
+    }
+    SSL_CTX_set_num_tickets(g_peerServerCtx, 0);
+    SSL_CTX_set_psk_server_callback(g_peerServerCtx, peerPskServerCallback);
+    SSL_CTX_set_psk_client_callback(g_peerClientCtx, peerPskClientCallback);
+    return true;
+}
+
+// Скопіювати вкладення на вузол одержувача; кадр followUp піде після останнього шматка
+void pushBlobToPeer(int nodeId, const std::string& hash, uint64_t size, const std::string& followUp) {
+    auto it = g_peerLinks.find(nodeId);
+    if (it == g_peerLinks.end()) return;
+
+    PeerLink& link = *it->second;
+    {
+        std::lock_guard<std::mutex> lock(link.mutex);
+        if (link.blobs.size() >= MAX_PEER_BLOB_PUSHES) {
+            std::cout << "[Cluster] Too many attachments queued for node " << nodeId
+                      << ", dropping " << hash << std::endl;
+            return;
+        }
+        PeerLink::BlobPush push;
+        push.hash = hash;
+        push.size = size;
+        push.followUp = followUp;
+        link.blobs.push_back(push);
+    }
+    link.cv.notify_one();
+}
+
+// Дописати до пачки один шматок поточного вкладення (BLOB:sha256|offset|дані).
+// Файл читається без м'ютекса каналу; зсув змінює лише потік відправки.
+void appendBlobChunk(PeerLink* link, std::string& batch) {
+    PeerLink::BlobPush push;
+    {
+        std::lock_guard<std::mutex> lock(link->mutex);
+        if (link->blobs.empty()) return;
+        push = link->blobs.front();
+    }
+
+    uint64_t length = std::min<uint64_t>(BlobStore::CHUNK_SIZE, push.size - push.offset);
+    std::string chunk((size_t)length, '\0');
+    std::ifstream in(g_blobs.path(push.hash), std::ios::binary);
+    in.seekg((std::streamoff)push.offset);
+    in.read(&chunk[0], (std::streamsize)length);
+
+    bool finished = !in || push.offset + length >= push.size;
+    if (in && length > 0) {
+        appendFrame(batch, "BLOB:" + push.hash + "|" + std::to_string(push.offset) + "|" + chunk);
+    }
+    if (finished) {
+        appendFrame(batch, push.followUp);
+    }
+
+    std::lock_guard<std::mutex> lock(link->mutex);
+    if (finished) {
+        link->blobs.pop_front();
+    } else {
+        link->blobs.front().offset += length;
+    }
+}
+
+// Потік вихідного каналу до вузла: підключитись, привітатись, відправити знімок статусів,
+// далі відправляти накопичені кадри пачками. При обриві - перепідключення.
+void peerSenderLoop(PeerLink* link) {
+    while (true) {
+        SOCKET s = connectToPeer(link->node);
+        if (s == INVALID_SOCKET) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        SSL* ssl = SSL_new(g_peerClientCtx);
+        SSL_set_fd(ssl, (int)s);
+        if (SSL_connect(ssl) != 1) {
+            printTlsErrors("cluster SSL_connect");
+            SSL_free(ssl);
+            closesocket(s);
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        std::cout << "[Cluster] Connected to node " << link->node.id << std::endl;
+
+        std::string presence;
+        for (const std::string& frame : presenceSnapshot()) {
+            appendFrame(presence, frame);
+        }
+
+        // NODE:id|епоха|номер першого кадру, далі непідтверджені кадри з тими самими номерами
+        std::string greeting;
+        {
+            std::lock_guard<std::mutex> lock(link->mutex);
+            appendFrame(greeting, "NODE:" + std::to_string(g_nodeId) + "|" + std::to_string(g_peerEpoch) + "|" +
+                                  std::to_string(link->inFlightFirst));
+            greeting += link->inFlight;
+            greeting += presence;
+            addInFlightLocked(*link, presence);
+        }
+
+        size_t sent = 0;
+        bool ok = sendAllTls(ssl, greeting, sent);
+        std::string batch, control;
+
+        while (ok) {
+            {
+                std::unique_lock<std::mutex> lock(link->mutex);
+                bool ready = link->cv.wait_for(lock, std::chrono::milliseconds(PEER_PING_INTERVAL_MS), [link]() {
+                    return !link->queue.empty() || !link->blobs.empty() || !link->ack.empty();
+                });
+                batch.swap(link->queue);
+                control.swap(link->ack);
+
+                // Нема чого відправляти - PING, щоб вузол не вважав канал мертвим (див. handlePeer)
+                if (!ready) appendFrame(control, "PING");
+            }
+
+            // Не більше одного шматка вкладення на пачку - кадри чату не чекають за файлом
+            appendBlobChunk(link, batch);
+
+            // Кадри стають непідтвердженими ще до відправки: після обриву вони підуть повторно
+            {
+                std::lock_guard<std::mutex> lock(link->mutex);
+                addInFlightLocked(*link, batch);
+            }
+
+            ok = sendAllTls(ssl, control + batch, sent);
+            batch.clear();
+            control.clear();
+        }
+
+        std::cout << "[Cluster] Lost connection to node " << link->node.id << std::endl;
+        SSL_free(ssl);
+        closesocket(s);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
+
+// Періодична повна розсилка статусів - відновлює узгодженість після втрачених оновлень
+void presenceSyncTick() {
+    for (const std::string& frame : presenceSnapshot()) {
+        sendToAllPeers(frame);
+    }
+    scheduleTimer(PRESENCE_SYNC_TICKS, []() { postWork(presenceSyncTick); });
+}
+
+// Відправка списку користувачів одному клієнту
+void sendUserList(SOCKET clientSocket) {
+    std::string payload;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        payload = g_chat.userListPayload(g_remoteUsers);
+    }
+    sendToClient(clientSocket, payload);
+}
+
+// Відправка списку користувачів ВСІМ онлайн клієнтам
+void broadcastUserList() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    for (const auto& pair : g_chat.users) {
+        if (pair.second.online && pair.second.connection != INVALID_CONNECTION) {
+            SOCKET userSocket = (SOCKET)pair.second.connection;
+            g_mutex.unlock();
+            sendUserList(userSocket);
+            flushClient(userSocket);
+            g_mutex.lock();
+        }
+    }
+}
+
+// Відкладена розсилка списку: кілька входів, виходів і оновлень статусу з інших
+// вузлів за USER_LIST_COALESCE_TICKS об'єднуються в одну розсилку
+void scheduleUserListBroadcast() {
+    if (g_userListBroadcastPending.exchange(true)) return;
+
+    scheduleTimer(USER_LIST_COALESCE_TICKS, []() {
+        g_userListBroadcastPending = false;
+        postWork(broadcastUserList);
+    });
+}
+
+// Зберегти повідомлення в історії
+void storeMessage(const std::string& from, const std::string& to, const std::string& text,
+                  const std::string& attachment = "") {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Message msg;
+    msg.from = from;
+    msg.to = to;
+    msg.text = text;
+    msg.attachment = attachment;
+    msg.timestamp = time(nullptr);
+    g_chat.addMessage(std::move(msg));
+}
+
+// Переслати кадр одержувачу цього вузла, якщо він онлайн
+void deliverToLocalUser(const std::string& to, const std::string& packet) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    auto it = g_chat.users.find(to);
+    if (it != g_chat.users.end() && it->second.online && it->second.connection != INVALID_CONNECTION) {
+        SOCKET recipientSocket = (SOCKET)it->second.connection;
+        g_mutex.unlock();
+        sendToClient(recipientSocket, packet);
+        flushClient(recipientSocket);
+        g_mutex.lock();
+    }
+}
+
+// Пересилання повідомлення від одного користувача іншому.
+// Історія зберігається на вузлі відправника і на вузлі одержувача,
+// тому GET_HISTORY завжди обслуговується локально.
+void forwardMessage(const std::string& from, const std::string& to, const std::string& text) {
+    storeMessage(from, to, text);
+
+    int owner = ownerNode(to);
+    if (owner != g_nodeId) {
+        sendToPeer(owner, "FWD:" + from + "|" + to + "|" + text);
+        return;
+    }
+
+    deliverToLocalUser(to, "MSG:" + from + "|" + text);
+}
+
+// Пересилання вкладення. attachment - "sha256|size|filename".
+// Якщо одержувач на іншому вузлі, спершу туди копіюється сам файл.
+void forwardAttachment(const std::string& from, const std::string& to, const std::string& attachment) {
+    storeMessage(from, to, "", attachment);
+
+    int owner = ownerNode(to);
+    if (owner != g_nodeId) {
+        size_t pos1 = attachment.find('|');
+        size_t pos2 = attachment.find('|', pos1 + 1);
+        std::string hash = attachment.substr(0, pos1);
+        uint64_t size = strtoull(attachment.substr(pos1 + 1, pos2 - pos1 - 1).c_str(), nullptr, 10);
+
+        pushBlobToPeer(owner, hash, size, "FWDFILE:" + from + "|" + to + "|" + attachment);
+        return;
+    }
+
+    deliverToLocalUser(to, "FILE:" + from + "|" + attachment);
+}
+
+void setOnline(const std::string& username, SOCKET clientSocket) {
+    std::unique_lock<std::shared_mutex> lock(g_onlineIndexMutex);
+    g_onlineIndex[username] = clientSocket;
+}
+
+void setOffline(const std::string& username) {
+    std::unique_lock<std::shared_mutex> lock(g_onlineIndexMutex);
+    g_onlineIndex.erase(username);
+}
+
+// Розіслати накопичені ефемерні події одним кадром на одержувача:
+// EVENTS:from|kind|value\nfrom|kind|value...
+// Одержувачі, чий сокет зараз не готовий до запису, свої події втрачають.
+void flushEphemeralEvents() {
+    std::map<std::string, std::map<std::string, std::string>> pending;
+    {
+        std::lock_guard<std::mutex> lock(g_ephemeralMutex);
+        pending.swap(g_ephemeralPending);
+        g_ephemeralFlushScheduled = false;
+    }
+
+    for (const auto& recipient : pending) {
+        SOCKET recipientSocket;
+        {
+            std::shared_lock<std::shared_mutex> lock(g_onlineIndexMutex);
+            auto it = g_onlineIndex.find(recipient.first);
+            if (it == g_onlineIndex.end()) continue;
+            recipientSocket = it->second;
+        }
+        if (!socketWritable(recipientSocket)) continue;
+
+        std::string packet = "EVENTS:";
+        for (const auto& event : recipient.second) {
+            if (packet.size() > 7) packet += "\n";
+            packet += event.first + "|" + event.second;
+        }
+        sendToClient(recipientSocket, packet);
+        flushClient(recipientSocket);
+    }
+}
+
+// Додати ефемерну подію для локального одержувача (з об'єднанням і відкиданням під навантаженням)
+void queueEphemeralEvent(const std::string& from, const std::string& to,
+                         const std::string& kind, const std::string& value) {
+    std::lock_guard<std::mutex> lock(g_ephemeralMutex);
+
+    auto it = g_ephemeralPending.find(to);
+    if (it == g_ephemeralPending.end()) {
+        if (g_ephemeralPending.size() >= MAX_EPHEMERAL_RECIPIENTS) return;
+        it = g_ephemeralPending.emplace(to, std::map<std::string, std::string>()).first;
+    }
+    it->second[from + "|" + kind] = value;
+
+    if (!g_ephemeralFlushScheduled) {
+        g_ephemeralFlushScheduled = true;
+        scheduleTimer(EPHEMERAL_FLUSH_TICKS, []() { postWork(flushEphemeralEvents); });
+    }
+}
+
+// Ефемерна подія до будь-якого користувача кластера.
+// На інший вузол - лише якщо канал не перевантажений; інакше подія просто зникає.
+void routeEphemeralEvent(const std::string& from, const std::string& to,
+                         const std::string& kind, const std::string& value) {
+    int owner = ownerNode(to);
+    if (owner == g_nodeId) {
+        queueEphemeralEvent(from, to, kind, value);
+        return;
+    }
+
+    auto it = g_peerLinks.find(owner);
+    if (it == g_peerLinks.end()) return;
+    {
+        std::lock_guard<std::mutex> lock(it->second->mutex);
+        if (it->second->queue.size() > EPHEMERAL_PEER_QUEUE_LIMIT) return;
+    }
+    sendToPeer(owner, "EVENT:" + from + "|" + to + "|" + kind + "|" + value);
+}
+
+// Обробка кадру від іншого вузла кластера
+void processPeerCommand(int peerId, const std::string& data) {
+    // === ПЕРЕСЛАНЕ ПОВІДОМЛЕННЯ: FWD:from|to|text ===
+    if (data.substr(0, 4) == "FWD:") {
+        std::string payload = data.substr(4);
+        size_t pos1 = payload.find('|');
+        size_t pos2 = payload.find('|', pos1 + 1);
+
+        if (pos1 != std::string::npos && pos2 != std::string::npos) {
+            std::string from = payload.substr(0, pos1);
+            std::string to = payload.substr(pos1 + 1, pos2 - pos1 - 1);
+            std::string text = payload.substr(pos2 + 1);
+
+            storeMessage(from, to, text);
+            deliverToLocalUser(to, "MSG:" + from + "|" + text);
+        }
+    }
+    // === ЕФЕМЕРНА ПОДІЯ: EVENT:from|to|kind|value ===
+    else if (data.substr(0, 6) == "EVENT:") {
+        std::stringstream fields(data.substr(6));
+        std::string from, to, kind, value;
+        if (std::getline(fields, from, '|') && std::getline(fields, to, '|') &&
+            std::getline(fields, kind, '|') && std::getline(fields, value)) {
+            queueEphemeralEvent(from, to, kind, value);
+        }
+    }
+    // === ШМАТОК ВКЛАДЕННЯ: BLOB:sha256|offset|дані ===
+    else if (data.substr(0, 5) == "BLOB:") {
+        size_t pos1 = data.find('|', 5);
+        size_t pos2 = data.find('|', pos1 + 1);
+        if (pos1 == std::string::npos || pos2 == std::string::npos) return;
+
+        std::string hash = data.substr(5, pos1 - 5);
+        uint64_t offset = strtoull(data.substr(pos1 + 1, pos2 - pos1 - 1).c_str(), nullptr, 10);
+        if (!BlobStore::isValidHash(hash) || g_blobs.exists(hash)) return;
+
+        g_blobs.append(hash, peerIdentity(peerId), offset, data.data() + pos2 + 1, data.size() - pos2 - 1);
+    }
+    // === ПЕРЕСЛАНЕ ВКЛАДЕННЯ: FWDFILE:from|to|sha256|size|filename ===
+    else if (data.substr(0, 8) == "FWDFILE:") {
+        std::string payload = data.substr(8);
+        size_t pos1 = payload.find('|');
+        size_t pos2 = payload.find('|', pos1 + 1);
+        size_t pos3 = payload.find('|', pos2 + 1);
+        size_t pos4 = payload.find('|', pos3 + 1);
+        if (pos1 == std::string::npos || pos2 == std::string::npos ||
+            pos3 == std::string::npos || pos4 == std::string::npos) return;
+
+        std::string from = payload.substr(0, pos1);
+        std::string to = payload.substr(pos1 + 1, pos2 - pos1 - 1);
+        std::string attachment = payload.substr(pos2 + 1);
+        std::string hash = payload.substr(pos2 + 1, pos3 - pos2 - 1);
+        uint64_t size = strtoull(payload.substr(pos3 + 1, pos4 - pos3 - 1).c_str(), nullptr, 10);
+
+        // Вузол автентифікований, тож блоб, що вже є в сховищі, повторно не перевіряється
+        if (!BlobStore::isValidHash(hash) ||
+            (!g_blobs.exists(hash) && g_blobs.finish(hash, peerIdentity(peerId), size) != BlobStore::Stored)) {
+            std::cout << "[Cluster] Attachment " << hash << " from node " << peerId << " is incomplete" << std::endl;
+            return;
+        }
+
+        storeMessage(from, to, "", attachment);
+        deliverToLocalUser(to, "FILE:" + from + "|" + attachment);
+    }
+    // === СТАТУСИ: PRESENCE:username|department|online\n... ===
+    else if (data.substr(0, 9) == "PRESENCE:") {
+        std::stringstream lines(data.substr(9));
+        std::string line;
+        bool changed = false;
+
+        std::lock_guard<std::mutex> lock(g_mutex);
+        while (std::getline(lines, line)) {
+            size_t pos1 = line.find('|');
+            size_t pos2 = line.find('|', pos1 + 1);
+            if (pos1 == std::string::npos || pos2 == std::string::npos) continue;
+
+            std::string username = line.substr(0, pos1);
+            RemoteUser& u = g_remoteUsers[username];
+            std::string department = line.substr(pos1 + 1, pos2 - pos1 - 1);
+            bool online = line.substr(pos2 + 1) == "1";
+
+            if (u.department != department || u.online != online || u.nodeId != peerId) {
+                u.department = department;
+                u.online = online;
+                u.nodeId = peerId;
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            scheduleUserListBroadcast();
+        }
+    }
+}
 
-// Структура повідомлення
-struct Message {
-    std::string from;
-    std::string to;
-    std::string text;
-    long long timestamp;
-};
+// Вхідне з'єднання від іншого вузла кластера.
+// Кадри після привітання пронумеровані (див. PeerLink); вже оброблені відкидаються,
+// після кожної пачки вузлу відправляється PACK з останнім обробленим номером.
+void handlePeer(SOCKET peerSocket) {
+    {
+        std::lock_guard<std::mutex> lock(g_peerSocketsMutex);
+        if (g_peerInboundClosed) {
+            closesocket(peerSocket);
+            return;
+        }
+        g_peerSockets.insert(peerSocket);
+    }
 
-// Структура користувача
-struct User {
-    std::string username;
-    std::string password;
-    std::string department;
-    bool online = false;
-    SOCKET socket = INVALID_SOCKET;
-};
+    // Вузол шле PING щонайменше раз на PEER_PING_INTERVAL_MS: тиша довша за PEER_TIMEOUT_MS -
+    // напіввідкрите з'єднання (вузол зник без FIN), SSL_read не повинен чекати вічно
+    DWORD timeout = PEER_TIMEOUT_MS;
+    setsockopt(peerSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(peerSocket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
 
-// Глобальні дані
-std::map<std::string, User> g_users;           // username -> User
-std::map<SOCKET, std::string> g_socketToUser;  // socket -> username
-std::vector<Message> g_messages;               // Історія всіх повідомлень
-std::mutex g_mutex;
+    SSL* ssl = SSL_new(g_peerServerCtx);
+    SSL_set_fd(ssl, (int)peerSocket);
 
-// Функція відправки повідомлення
-void sendToClient(SOCKET clientSocket, const std::string& msg) {
-    std::string packet = std::to_string(msg.length()) + ":" + msg;
-    send(clientSocket, packet.c_str(), (int)packet.length(), 0);
-    std::cout << "[Server -> Client] " << msg.substr(0, 50) << std::endl;
-}
+    // Вузол, що в handshake довів знання секрету кластера (див. peerPskServerCallback)
+    int authenticatedId = 0;
+    if (SSL_accept(ssl) == 1) {
+        authenticatedId = (int)(intptr_t)SSL_get_app_data(ssl);
+    } else {
+        printTlsErrors("cluster SSL_accept");
+    }
 
-// Відправка списку користувачів одному клієнту
-void sendUserList(SOCKET clientSocket) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    std::stringstream ss;
-    ss << "USERS:";
+    char buffer[16384];
+    std::string inbox;
+    int peerId = 0;
+    uint64_t epoch = 0;
+    uint64_t nextSeq = 0;  // Номер наступного кадру в цьому з'єднанні
+    bool running = authenticatedId != 0;
+    if (!running) std::cout << "[Cluster] Rejected peer connection" << std::endl;
 
-    bool first = true;
-    for (const auto& pair : g_users) {
-        if (!first) ss << "\n";
-        first = false;
+    while (running) {
+        int bytesReceived = SSL_read(ssl, buffer, sizeof(buffer));
+        if (bytesReceived <= 0) break;
+        inbox.append(buffer, bytesReceived);
 
-        const User& u = pair.second;
-        ss << u.username << "|" << u.department << "|" << (u.online ? "1" : "0");
+        std::string data;
+        int status = 0;
+        bool numbered = false;
+        while (running && (status = extractFrame(inbox, data)) == 1) {
+            if (peerId == 0) {
+                // Перший кадр - NODE:id|епоха|номер, той самий вузол, що й ідентичність з handshake
+                size_t pos1 = data.find('|');
+                size_t pos2 = pos1 == std::string::npos ? pos1 : data.find('|', pos1 + 1);
+                if (data.substr(0, 5) != "NODE:" || pos2 == std::string::npos ||
+                    atoi(data.substr(5, pos1 - 5).c_str()) != authenticatedId) {
+                    std::cout << "[Cluster] Rejected peer connection" << std::endl;
+                    running = false;
+                    break;
+                }
+                peerId = authenticatedId;
+                epoch = strtoull(data.c_str() + pos1 + 1, nullptr, 10);
+                nextSeq = strtoull(data.c_str() + pos2 + 1, nullptr, 10);
+                {
+                    std::lock_guard<std::mutex> lock(g_peerInboundMutex);
+                    PeerInbound& inbound = g_peerInbound[peerId];
+                    if (inbound.epoch != epoch) inbound = PeerInbound{epoch, 0};
+                    inbound.connection = peerSocket;
+                }
+                std::cout << "[Cluster] Node " << peerId << " connected" << std::endl;
+                continue;
+            }
+            if (startsWith(data, "PACK:")) {
+                acknowledgePeerFrames(peerId, data);
+                continue;
+            }
+            if (data == "PING") continue;  // Лише підтримує з'єднання, поза нумерацією
+
+            uint64_t seq = nextSeq++;
+            bool fresh;
+            {
+                std::lock_guard<std::mutex> lock(g_peerInboundMutex);
+                PeerInbound& inbound = g_peerInbound[peerId];
+                fresh = inbound.epoch == epoch && seq > inbound.lastSeq;
+                if (fresh) inbound.lastSeq = seq;
+            }
+            if (fresh) processPeerCommand(peerId, data);
+            numbered = true;
+        }
+        if (status < 0) running = false;
+
+        if (numbered) {
+            uint64_t lastSeq;
+            {
+                std::lock_guard<std::mutex> lock(g_peerInboundMutex);
+                const PeerInbound& inbound = g_peerInbound[peerId];
+                if (inbound.epoch != epoch) continue;  // Вузол уже перепідключився з новою епохою
+                lastSeq = inbound.lastSeq;
+            }
+            queuePeerAck(peerId, epoch, lastSeq);
+        }
+    }
+
+    // Вузол недоступний - його користувачі вважаються офлайн. Якщо вузол уже
+    // перепідключився, статуси належать новому з'єднанню і не чіпаються
+    bool current = false;
+    if (peerId != 0) {
+        std::lock_guard<std::mutex> lock(g_peerInboundMutex);
+        PeerInbound& inbound = g_peerInbound[peerId];
+        current = inbound.connection == peerSocket;
+        if (current) inbound.connection = INVALID_SOCKET;
+    }
+    if (current) {
+        std::cout << "[Cluster] Node " << peerId << " disconnected" << std::endl;
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (auto& pair : g_remoteUsers) {
+            if (pair.second.nodeId == peerId) pair.second.online = false;
+        }
+        scheduleUserListBroadcast();
     }
 
-    sendToClient(clientSocket, ss.str());
+    SSL_free(ssl);
+    {
+        std::lock_guard<std::mutex> lock(g_peerSocketsMutex);
+        g_peerSockets.erase(peerSocket);
+        closesocket(peerSocket);
+    }
+    g_peerSocketsCv.notify_all();
 }
 
-// Відправка списку користувачів ВСІМ онлайн клієнтам
-void broadcastUserList() {
-    std::lock_guard<std::mutex> lock(g_mutex);
+// Перестати приймати кадри від вузлів і дочекатися, поки обробники завершаться:
+// після цього стан, що зберігається, містить усе підтверджене вузлам через PACK
+void closePeerInbound(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(g_peerSocketsMutex);
+    g_peerInboundClosed = true;
+    for (SOCKET s : g_peerSockets) {
+        shutdown(s, SD_BOTH);
+    }
+    if (!g_peerSocketsCv.wait_until(lock, deadline, []() { return g_peerSockets.empty(); })) {
+        std::cout << "[Server] " << g_peerSockets.size() << " peer connection(s) did not close" << std::endl;
+    }
+}
 
-    for (const auto& pair : g_users) {
-        if (pair.second.online && pair.second.socket != INVALID_SOCKET) {
-            g_mutex.unlock();
-            sendUserList(pair.second.socket);
-            g_mutex.lock();
+void clusterAcceptLoop(SOCKET listenSocket) {
+    while (!g_shuttingDown) {
+        SOCKET peerSocket = accept(listenSocket, NULL, NULL);
+        if (peerSocket != INVALID_SOCKET) {
+            std::thread(handlePeer, peerSocket).detach();
         }
     }
 }
 
-// Відправка історії повідомлень між двома користувачами
-void sendChatHistory(SOCKET clientSocket, const std::string& user1, const std::string& user2) {
-    std::lock_guard<std::mutex> lock(g_mutex);
+// Розбір "id=host:clientPort:clusterPort"
+bool parseClusterNode(const std::string& spec, ClusterNode& node) {
+    size_t eq = spec.find('=');
+    size_t colon1 = spec.find(':', eq + 1);
+    size_t colon2 = spec.find(':', colon1 + 1);
+    if (eq == std::string::npos || colon1 == std::string::npos || colon2 == std::string::npos) {
+        return false;
+    }
 
-    for (const auto& msg : g_messages) {
-        // Перевірити чи повідомлення між цими двома користувачами
-        if ((msg.from == user1 && msg.to == user2) ||
-            (msg.from == user2 && msg.to == user1)) {
+    node.id = atoi(spec.substr(0, eq).c_str());
+    node.host = spec.substr(eq + 1, colon1 - eq - 1);
+    node.clientPort = atoi(spec.substr(colon1 + 1, colon2 - colon1 - 1).c_str());
+    node.clusterPort = atoi(spec.substr(colon2 + 1).c_str());
+    return node.id > 0 && node.clientPort > 0 && node.clusterPort > 0;
+}
 
-            std::string packet = "MSG:" + msg.from + "|" + msg.text;
-            g_mutex.unlock();
-            sendToClient(clientSocket, packet);
-            g_mutex.lock();
-        }
+SOCKET createListenSocket(int port) {
+    SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listenSocket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((u_short)port);
+
+    if (bind(listenSocket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
+        closesocket(listenSocket);
+        return INVALID_SOCKET;
     }
+    return listenSocket;
 }
 
-// Пересилання повідомлення від одного користувача іншому
-void forwardMessage(const std::string& from, const std::string& to, const std::string& text) {
-    // Зберегти повідомлення в історії
-    {
-        std::lock_guard<std::mutex> lock(g_mutex);
-        Message msg;
-        msg.from = from;
-        msg.to = to;
-        msg.text = text;
-        msg.timestamp = time(nullptr);
-        g_messages.push_back(msg);
+// Якщо користувач належить іншому вузлу - відправити клієнта туди
+bool redirectIfRemote(SOCKET clientSocket, const std::string& username) {
+    int owner = ownerNode(username);
+    if (owner == g_nodeId) return false;
+
+    const ClusterNode& node = g_nodes[owner];
+    sendToClient(clientSocket, "REDIRECT:" + node.host + ":" + std::to_string(node.clientPort));
+    return true;
+}
+
+// Мережевий рівень для CommandDispatcher: ConnectionId - це SOCKET клієнта
+class SocketHooks : public ServerHooks {
+public:
+    uint64_t nowMillis() override {
+        return currentMillis();
     }
 
-    // Переслати одержувачу якщо він онлайн
-    std::lock_guard<std::mutex> lock(g_mutex);
-    auto it = g_users.find(to);
-    if (it != g_users.end() && it->second.online && it->second.socket != INVALID_SOCKET) {
-        std::string packet = "MSG:" + from + "|" + text;
-        g_mutex.unlock();
-        sendToClient(it->second.socket, packet);
-        g_mutex.lock();
+    void send(ConnectionId connection, const std::string& msg) override {
+        sendToClient((SOCKET)connection, msg);
+    }
+
+    bool redirectIfRemote(ConnectionId connection, const std::string& username) override {
+        return ::redirectIfRemote((SOCKET)connection, username);
+    }
+
+    void presenceChanged(const User& user) override {
+        if (user.online) setOnline(user.username, (SOCKET)user.connection);
+        else setOffline(user.username);
+        gossipPresenceLocked(user);
+    }
+
+    void sendUserList(ConnectionId connection) override {
+        ::sendUserList((SOCKET)connection);
+    }
+
+    void broadcastUserList() override {
+        scheduleUserListBroadcast();
+    }
+
+    void routeEvent(const std::string& from, const std::string& to,
+                    const std::string& kind, const std::string& value) override {
+        routeEphemeralEvent(from, to, kind, value);
+    }
+
+    void forwardMessage(const std::string& from, const std::string& to, const std::string& text) override {
+        ::forwardMessage(from, to, text);
+    }
+
+    void forwardAttachment(const std::string& from, const std::string& to, const std::string& attachment) override {
+        ::forwardAttachment(from, to, attachment);
+    }
+
+    bool startDownload(ConnectionId connection, const std::string& hash, uint64_t offset) override {
+        return ::startDownload((SOCKET)connection, hash, offset);
+    }
+};
+
+SocketHooks g_hooks;
+CommandDispatcher g_dispatcher(g_chat, g_mutex, g_blobs, g_hooks);
+
+// Текстова IP-адреса клієнта (ключ для лімітів з'єднань)
+std::string peerAddress(const sockaddr_storage& address) {
+    char text[INET6_ADDRSTRLEN] = {0};
+    if (address.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((const sockaddr_in*)&address)->sin_addr, text, sizeof(text));
+    } else if (address.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const sockaddr_in6*)&address)->sin6_addr, text, sizeof(text));
+    }
+    return text;
+}
+
+// Допустити нове з'єднання з IP: не більше g_maxConnectionsPerIp одночасно і не частіше
+// CONNECTION_ACCEPT_RATE. Перевіряється одразу після accept(), до TLS-рукостискання і потоку.
+bool admitConnection(const std::string& ip) {
+    std::lock_guard<std::mutex> lock(g_ipMutex);
+    uint64_t now = currentMillis();
+
+    if (g_ipStates.size() >= MAX_TRACKED_IPS && !g_ipStates.count(ip)) {
+        for (auto it = g_ipStates.begin(); it != g_ipStates.end();) {
+            if (it->second.connections == 0 && it->second.accepts.isFull(now)) it = g_ipStates.erase(it);
+            else ++it;
+        }
+        if (g_ipStates.size() >= MAX_TRACKED_IPS) return false;
+    }
+
+    IpState& state = g_ipStates[ip];
+    if (state.connections >= g_maxConnectionsPerIp || !state.accepts.tryConsume(now)) {
+        return false;
+    }
+    state.connections++;
+    return true;
+}
+
+void releaseConnection(const std::string& ip) {
+    std::lock_guard<std::mutex> lock(g_ipMutex);
+    auto it = g_ipStates.find(ip);
+    if (it != g_ipStates.end() && it->second.connections > 0) {
+        it->second.connections--;
     }
 }
 
 // Обробка одного клієнта в окремому потоці
-void handleClient(SOCKET clientSocket) {
+void handleClient(SOCKET clientSocket, std::string clientIp) {
     std::cout << "\n[Thread " << std::this_thread::get_id() << "] New client connected" << std::endl;
 
-    char buffer[4096];
-    std::string currentUser;
+    auto conn = std::make_shared<Connection>();
+    conn->socket = clientSocket;
+    conn->ssl = SSL_new(g_sslCtx);
+    conn->rbio = BIO_new(BIO_s_mem());
+    conn->wbio = BIO_new(BIO_s_mem());
+    BIO_set_mem_eof_return(conn->rbio, -1);  // Порожній rbio = "чекати ще даних", а не EOF
+    SSL_set_bio(conn->ssl, conn->rbio, conn->wbio);
+    SSL_set_accept_state(conn->ssl);
 
-    while (true) {
-        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
+    conn->lastActivityTick = currentTick();
+
+    DWORD sendTimeout = CLIENT_SEND_TIMEOUT_MS;
+    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
+
+    {
+        std::lock_guard<std::mutex> lock(g_connMutex);
+        g_connections[clientSocket] = conn;
+    }
+
+    std::weak_ptr<Connection> weakConn = conn;
+    scheduleTimer(HEARTBEAT_INTERVAL_TICKS, [weakConn]() { checkHeartbeat(weakConn); });
+
+    char buffer[16384];
+    std::string inbox;  // Розшифровані байти, що ще не склались у повний кадр
+    ClientSession session(clientSocket);
+    session.address = clientIp;
+    bool running = true;
+
+    t_recordReplies = true;
+    if (g_recording) recordEvent(clientSocket, " open");
 
-        if (bytesReceived <= 0) {
+    while (running) {
+        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
+
+        if (bytesReceived <= 0 || !tlsReceive(*conn, buffer, bytesReceived, inbox)) {
             break;
         }
+        conn->lastActivityTick = currentTick();
+
+        {
+            std::unique_lock<std::mutex> recordLock(g_recordDispatchMutex, std::defer_lock);
+            if (g_recording) recordLock.lock();
 
-        buffer[bytesReceived] = '\0';
-        std::string data(buffer);
+            // Обробити всі повні кадри "довжина:дані" з буфера
+            std::string data;
+            int status;
+            int frames = 0;
+            while ((status = extractFrame(inbox, data)) == 1) {
+                if (g_recording) recordEvent(clientSocket, "> ", data);
+                g_dispatcher.process(session, data);
+                frames++;
+            }
+            if (status < 0) {
+                std::cout << "[Server] Invalid frame from client" << std::endl;
+                running = false;
+            }
 
-        // Видалити префікс довжини "123:MSG..."
-        size_t colonPos = data.find(':');
-        if (colonPos != std::string::npos) {
-            data = data.substr(colonPos + 1);
+            // Одне кумулятивне ACK і одна відповідь про ліміт на всю пачку команд
+            if (g_recording && frames > 0) recordEvent(clientSocket, " flush");
+            g_dispatcher.finishBatch(session);
         }
 
-        std::cout << "[Client] " << data.substr(0, 100) << std::endl;
+        // Усі відповіді на цю порцію команд - одним TLS-записом
+        flushClient(clientSocket);
+    }
 
-        // === РЕЄСТРАЦІЯ: REG:username|password|department ===
-        if (data.substr(0, 4) == "REG:") {
-            std::string payload = data.substr(4);
 
-            size_t pos1 = payload.find('|');
-            size_t pos2 = payload.find('|', pos1 + 1);
+    std::cout << "[Thread " << std::this_thread::get_id() << "] Client disconnected" << std::endl;
 
-            if (pos1 != std::string::npos && pos2 != std::string::npos) {
-                std::string username = payload.substr(0, pos1);
-                std::string password = payload.substr(pos1 + 1, pos2 - pos1 - 1);
-                std::string department = payload.substr(pos2 + 1);
+    {
+        std::unique_lock<std::mutex> recordLock(g_recordDispatchMutex, std::defer_lock);
+        if (g_recording) recordLock.lock();
 
-                std::lock_guard<std::mutex> lock(g_mutex);
+        if (g_recording) recordEvent(clientSocket, " close");
+        g_dispatcher.logout(session);
+    }
 
-                if (g_users.find(username) != g_users.end()) {
-                    sendToClient(clientSocket, "ERROR:User already exists");
-                } else {
-                    User newUser;
-                    newUser.username = username;
-                    newUser.password = password;
-                    newUser.department = department;
-                    newUser.online = false;
+    // Дочекатися потоку, що саме пише в сокет (send() після shutdown завершується помилкою)
+    closeConnection(*conn);
+    {
+        std::lock_guard<std::mutex> lock(conn->ioMutex);
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_connMutex);
+        g_connections.erase(clientSocket);
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->closeMutex);
+        conn->socketReleased = true;
+        closesocket(clientSocket);
+    }
+    releaseConnection(clientIp);
+}
 
-                    g_users[username] = newUser;
+// ================= Збереження стану, плавна зупинка, гарячий перезапуск =================
 
-                    std::cout << "[Server] Registered: " << username << " (" << department << ")" << std::endl;
-                    sendToClient(clientSocket, "OK:Registered");
-                }
-            } else {
-                sendToClient(clientSocket, "ERROR:Invalid registration format");
-            }
+std::string stateFilePath() {
+    return "state_" + std::to_string(g_clientPort) + ".dat";
+}
+
+std::string controlSocketPath() {
+    return "server_" + std::to_string(g_clientPort) + ".sock";
+}
+
+// Записати користувачів (з хешами паролів), історію і вікна дублікатів у файл стану.
+// Поля - у тому ж форматі "довжина:дані", що й кадри протоколу.
+// Спершу в .tmp, доступний лише серверу, потім перейменування - обірваний запис не псує попередній файл.
+bool saveState() {
+    std::string data;
+    appendFrame(data, STATE_FILE_MAGIC);
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (const auto& pair : g_chat.users) {
+            appendFrame(data, "USER");
+            appendFrame(data, pair.second.username);
+            appendFrame(data, pair.second.passwordHash);
+            appendFrame(data, pair.second.department);
+        }
+        for (const Message& msg : g_chat.messages) {
+            appendFrame(data, "MSG");
+            appendFrame(data, msg.from);
+            appendFrame(data, msg.to);
+            appendFrame(data, msg.text);
+            appendFrame(data, msg.attachment);
+            appendFrame(data, std::to_string(msg.timestamp));
+        }
+    }
+    // WINDOW:key, межа, час, номери після межі через кому (прийняті з пропуском)
+    for (const auto& pair : g_dispatcher.deliveryStates.snapshot()) {
+        std::lock_guard<std::mutex> stateLock(pair.second->mutex);
+        std::string ahead;
+        for (uint64_t seq : pair.second->window.acceptedAhead()) {
+            if (!ahead.empty()) ahead += ',';
+            ahead += std::to_string(seq);
+        }
+        appendFrame(data, "WINDOW");
+        appendFrame(data, pair.first);
+        appendFrame(data, std::to_string(pair.second->window.highestContiguous()));
+        appendFrame(data, std::to_string((long long)pair.second->lastUsed));
+        appendFrame(data, ahead);
+    }
+    // PEER:вузол, епоха, останній оброблений номер - щоб не обробити повтор вдруге
+    {
+        std::lock_guard<std::mutex> lock(g_peerInboundMutex);
+        for (const auto& pair : g_peerInbound) {
+            appendFrame(data, "PEER");
+            appendFrame(data, std::to_string(pair.first));
+            appendFrame(data, std::to_string(pair.second.epoch));
+            appendFrame(data, std::to_string(pair.second.lastSeq));
         }
-        // === ЛОГІН: LOGIN:username|password ===
-        else if (data.substr(0, 6) == "LOGIN:") {
-            std::string payload = data.substr(6);
+    }
+    appendFrame(data, "END");
+
+    std::string tmpPath = stateFilePath() + ".tmp";
+    if (!writePrivateFile(tmpPath.c_str(), data.data(), data.size())) return false;
 
-            size_t pos = payload.find('|');
-            if (pos != std::string::npos) {
-                std::string username = payload.substr(0, pos);
-                std::string password = payload.substr(pos + 1);
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, stateFilePath(), ec);
+    return !ec;
+}
 
-                std::lock_guard<std::mutex> lock(g_mutex);
+// Завантажити стан, збережений попереднім процесом. Файл читається порціями,
+// тому пам'ять потрібна лише під самі дані, а не під копію файлу
+bool loadState() {
+    std::ifstream in(stateFilePath(), std::ios::binary);
+    if (!in) return true;  // Перший запуск
 
-                auto it = g_users.find(username);
-                if (it == g_users.end()) {
-                    sendToClient(clientSocket, "ERROR:User not found");
-                } else if (it->second.password != password) {
-                    sendToClient(clientSocket, "ERROR:Wrong password");
-                } else if (it->second.online) {
-                    sendToClient(clientSocket, "ERROR:User already logged in");
-                } else {
-                    it->second.online = true;
-                    it->second.socket = clientSocket;
-                    currentUser = username;
-                    g_socketToUser[clientSocket] = username;
-
-                    std::cout << "[Server] Logged in: " << username << std::endl;
-
-                    g_mutex.unlock();
-                    sendToClient(clientSocket, "OK:Logged in");
-                    sendUserList(clientSocket);
-                    broadcastUserList();
-                    g_mutex.lock();
+    ChatStore chat;
+    std::vector<std::pair<std::string, std::shared_ptr<DeliveryState>>> deliveryStates;  // У порядку файлу (LRU)
+    std::map<int, PeerInbound> peerInbound;
+
+    std::vector<std::string> record;
+    std::string inbox, field;
+    char buffer[64 * 1024];
+    bool started = false, finished = false;
+    size_t plaintextPasswords = 0;
+
+    while (!finished && (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)) {
+        inbox.append(buffer, (size_t)in.gcount());
+
+        int status;
+        while (!finished && (status = extractFrame(inbox, field)) == 1) {
+            if (!started) {
+                if (field != STATE_FILE_MAGIC) return false;
+                started = true;
+                continue;
+            }
+
+            record.push_back(field);
+            const std::string& type = record[0];
+
+            if (type == "END") {
+                finished = true;
+            } else if (type == "USER" && record.size() == 4) {
+                User& u = chat.users[record[1]];
+                u.username = record[1];
+                u.passwordHash = record[2];
+                u.department = record[3];
+                // Попередні версії зберігали пароль у відкритому вигляді
+                if (!isPasswordHash(u.passwordHash)) {
+                    u.passwordHash = hashPassword(record[2]);
+                    if (u.passwordHash.empty()) return false;
+                    plaintextPasswords++;
                 }
-            } else {
-                sendToClient(clientSocket, "ERROR:Invalid login format");
+                record.clear();
+            } else if (type == "MSG" && record.size() == 6) {
+                Message msg;
+                msg.from = record[1];
+                msg.to = record[2];
+                msg.text = record[3];
+                msg.attachment = record[4];
+                msg.timestamp = atoll(record[5].c_str());
+                chat.addMessage(std::move(msg));  // Права на вкладення відновлюються з історії
+                record.clear();
+            } else if ((type == "WINDOW" && record.size() == 5) || (type == "SEQ" && record.size() == 4)) {
+                // SEQ - формат попередньої версії, без номерів після межі
+                std::vector<uint64_t> ahead;
+                if (type == "WINDOW") {
+                    std::stringstream list(record[4]);
+                    std::string seq;
+                    while (std::getline(list, seq, ',')) ahead.push_back(strtoull(seq.c_str(), nullptr, 10));
+                }
+
+                auto state = std::make_shared<DeliveryState>();
+                state->window.restore(strtoull(record[2].c_str(), nullptr, 10), ahead);
+                state->lastUsed = (time_t)atoll(record[3].c_str());
+                deliveryStates.emplace_back(record[1], state);
+                record.clear();
+            } else if (type == "PEER" && record.size() == 4) {
+                PeerInbound& inbound = peerInbound[atoi(record[1].c_str())];
+                inbound.epoch = strtoull(record[2].c_str(), nullptr, 10);
+                inbound.lastSeq = strtoull(record[3].c_str(), nullptr, 10);
+                record.clear();
+            } else if (type != "USER" && type != "MSG" && type != "SEQ" && type != "WINDOW" && type != "PEER") {
+                return false;
             }
         }
-        // === ОТРИМАТИ СПИСОК: GET_USERS ===
-        else if (data == "GET_USERS") {
-            sendUserList(clientSocket);
+        if (status < 0) return false;
+    }
+
+    // Без END файл обрізаний - краще почати з порожнього стану, ніж з частини історії
+    if (!finished) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_chat.users.swap(chat.users);
+        g_chat.messages.swap(chat.messages);
+        g_chat.blobAccess.swap(chat.blobAccess);
+    }
+    for (auto& pair : deliveryStates) {
+        g_dispatcher.deliveryStates.restore(pair.first, std::move(pair.second));
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_peerInboundMutex);
+        g_peerInbound.swap(peerInbound);
+    }
+
+    std::cout << "[Server] Restored " << g_chat.users.size() << " users, "
+              << g_chat.messages.size() << " messages" << std::endl;
+
+    // Не лишати паролі у відкритому вигляді на диску до наступної зупинки
+    if (plaintextPasswords > 0) {
+        std::cout << "[Server] Hashed " << plaintextPasswords << " plaintext password(s)" << std::endl;
+        if (!saveState()) std::cout << "[Server] Failed to rewrite state file" << std::endl;
+    }
+    return true;
+}
+
+// Припинити приймати з'єднання: закритий слухаючий сокет виводить main() з accept()
+void requestShutdown() {
+    if (g_shuttingDown.exchange(true)) return;
+
+    SOCKET s = g_listenSocket.exchange(INVALID_SOCKET);
+    if (s != INVALID_SOCKET) closesocket(s);
+
+    s = g_clusterListenSocket.exchange(INVALID_SOCKET);
+    if (s != INVALID_SOCKET) closesocket(s);
+}
+
+// Ctrl+C, закриття консолі, завершення сеансу Windows.
+// Після повернення з обробника процес може бути завершений, тому чекаємо кінця drain
+BOOL WINAPI consoleCtrlHandler(DWORD ctrlType) {
+    std::cout << "\n[Server] Shutdown requested (" << ctrlType << ")" << std::endl;
+    requestShutdown();
+
+    std::unique_lock<std::mutex> lock(g_shutdownMutex);
+    g_shutdownCv.wait_for(lock, std::chrono::milliseconds(DRAIN_TIMEOUT_MS * 3), []() { return g_drained; });
+    return TRUE;
+}
+
+// Плавна зупинка після того, як нові з'єднання вже не приймаються:
+// 1) клієнтам - RECONNECT:затримка з розкидом (без шторму перепідключень), вихідні буфери дочищаються;
+// 2) чекаємо, поки потоки клієнтів завершаться, а вузли кластера підтвердять усі кадри;
+// 3) вхідні канали вузлів закриваються, останні PACK відправляються - кадри, що прийдуть
+//    далі, вузли повторять новому процесу;
+// 4) стан записується на диск - його підхопить наступний процес.
+void drainServer() {
+    std::vector<std::shared_ptr<Connection>> connections;
+    {
+        std::lock_guard<std::mutex> lock(g_connMutex);
+        for (const auto& pair : g_connections) {
+            connections.push_back(pair.second);
+        }
+    }
+
+    std::cout << "[Server] Draining " << connections.size() << " connection(s)" << std::endl;
+
+    std::mt19937 random(std::random_device{}());
+    std::uniform_int_distribution<int> jitter(0, RECONNECT_JITTER_MS);
+
+    // З'єднання, зайняте довгим записом, або все, що не встигли за DRAIN_TIMEOUT_MS,
+    // закривається без RECONNECT - клієнт перепідключиться сам
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_TIMEOUT_MS);
+    for (const auto& conn : connections) {
+        std::unique_lock<std::mutex> lock(conn->ioMutex, std::try_to_lock);
+        if (!lock.owns_lock() || std::chrono::steady_clock::now() >= deadline) {
+            closeConnection(*conn);
+            continue;
         }
-        // === ЗАПИТ ІСТОРІЇ: GET_HISTORY:username ===
-        else if (data.substr(0, 12) == "GET_HISTORY:") {
-            std::string otherUser = data.substr(12);
+        if (conn->closed) continue;
 
-            if (!currentUser.empty()) {
-                std::cout << "[Server] Sending chat history: " << currentUser << " <-> " << otherUser << std::endl;
-                sendChatHistory(clientSocket, currentUser, otherUser);
+        {
+            std::lock_guard<std::mutex> closeLock(conn->closeMutex);
+            DWORD sendTimeout = DRAIN_SEND_TIMEOUT_MS;
+            if (!conn->socketReleased) {
+                setsockopt(conn->socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
             }
         }
-        // === ПОВІДОМЛЕННЯ: MSG:recipient|text ===
-        else if (data.substr(0, 4) == "MSG:") {
-            std::string payload = data.substr(4);
-            size_t pos = payload.find('|');
 
-            if (pos != std::string::npos && !currentUser.empty()) {
-                std::string recipient = payload.substr(0, pos);
-                std::string text = payload.substr(pos + 1);
+        appendFrame(conn->outBuffer, "RECONNECT:" + std::to_string(RECONNECT_MIN_DELAY_MS + jitter(random)));
+        conn->downloads.clear();  // Клієнт продовжить завантаження з того ж зсуву
+        flushLocked(*conn);
+        closeConnection(*conn);
+    }
+    connections.clear();
 
-                std::cout << "[Message] " << currentUser << " -> " << recipient << ": " << text << std::endl;
+    while (std::chrono::steady_clock::now() < deadline) {
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(g_connMutex);
+            idle = g_connections.empty();
+        }
+        for (auto& pair : g_peerLinks) {
+            std::lock_guard<std::mutex> lock(pair.second->mutex);
+            idle = idle && pair.second->queue.empty() && pair.second->inFlight.empty() && pair.second->blobs.empty();
+        }
+        if (idle) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
 
-                forwardMessage(currentUser, recipient, text);
-                sendToClient(clientSocket, "OK:Sent");
-            } else {
-                sendToClient(clientSocket, "ERROR:Not logged in or invalid format");
+    if (isClusterEnabled()) {
+        auto peerDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_PEER_TIMEOUT_MS);
+        closePeerInbound(peerDeadline);
+        while (std::chrono::steady_clock::now() < peerDeadline) {
+            bool acked = true;
+            for (auto& pair : g_peerLinks) {
+                std::lock_guard<std::mutex> lock(pair.second->mutex);
+                acked = acked && pair.second->ack.empty();
             }
+            if (acked) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
-        // === ВИХІД: LOGOUT ===
-        else if (data == "LOGOUT") {
-            if (!currentUser.empty()) {
-                std::lock_guard<std::mutex> lock(g_mutex);
+    }
 
-                auto it = g_users.find(currentUser);
-                if (it != g_users.end()) {
-                    it->second.online = false;
-                    it->second.socket = INVALID_SOCKET;
-                }
+    if (saveState()) {
+        std::cout << "[Server] State saved to " << stateFilePath() << std::endl;
+    } else {
+        std::cout << "[Server] Failed to save state to " << stateFilePath() << std::endl;
+    }
+}
+
+bool recvExact(SOCKET s, char* data, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        int n = recv(s, data + received, (int)(length - received), 0);
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
 
-                g_socketToUser.erase(clientSocket);
+// Рядок протоколу керування (до '\n'), не довший за 256 байт
+bool recvLine(SOCKET s, std::string& line) {
+    line.clear();
+    char c;
+    while (line.size() < 256) {
+        if (!recvExact(s, &c, 1)) return false;
+        if (c == '\n') return true;
+        line += c;
+    }
+    return false;
+}
 
-                std::cout << "[Server] Logged out: " << currentUser << std::endl;
-                currentUser.clear();
+SOCKET createControlSocket() {
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
 
-                g_mutex.unlock();
-                broadcastUserList();
-                g_mutex.lock();
-            }
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, controlSocketPath().c_str(), sizeof(addr.sun_path) - 1);
+
+    std::error_code ec;
+    std::filesystem::remove(controlSocketPath(), ec);  // Залишок після аварійного завершення
+
+    if (bind(s, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(s, 1) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// Потік керування. Нова версія сервера (--takeover) підключається через AF_UNIX і надсилає
+// TAKEOVER:pid. У відповідь отримує ключі session tickets і дублікати слухаючих сокетів
+// (WSADuplicateSocket - аналог передачі дескрипторів через SCM_RIGHTS), після чого цей
+// процес перестає приймати з'єднання і виконує drain. Нові підключення тим часом чекають
+// у черзі того самого сокета - порт не закривається ні на мить.
+// Доступ до протоколу визначається правами на файл сокета в робочому каталозі сервера.
+void controlLoop() {
+    while (!g_shuttingDown) {
+        SOCKET s = accept(g_controlSocket, NULL, NULL);
+        if (s == INVALID_SOCKET) continue;
+
+        std::string line;
+        if (!recvLine(s, line) || line.substr(0, 9) != "TAKEOVER:") {
+            closesocket(s);
+            continue;
+        }
+        DWORD pid = (DWORD)strtoul(line.substr(9).c_str(), nullptr, 10);
+
+        // Спільні ключі tickets - клієнти відновлять TLS-сесію без повного handshake
+        unsigned char ticketKeys[TICKET_KEYS_SIZE];
+        SSL_CTX_get_tlsext_ticket_keys(g_sslCtx, ticketKeys, sizeof(ticketKeys));
+
+        std::vector<WSAPROTOCOL_INFOW> sockets(1);
+        bool ok = WSADuplicateSocketW(g_listenSocket, pid, &sockets[0]) == 0;
+        if (ok && isClusterEnabled()) {
+            sockets.emplace_back();
+            ok = WSADuplicateSocketW(g_clusterListenSocket, pid, &sockets[1]) == 0;
         }
+        if (!ok) {
+            std::cout << "[Server] WSADuplicateSocket failed: " << WSAGetLastError() << std::endl;
+            closesocket(s);
+            continue;
+        }
+
+        std::string reply = "SOCKETS:" + std::to_string(sockets.size()) + "\n";
+        reply.append((const char*)ticketKeys, sizeof(ticketKeys));
+        reply.append((const char*)sockets.data(), sockets.size() * sizeof(WSAPROTOCOL_INFOW));
+
+        // Закривати свої сокети лише після того, як новий процес їх відкрив
+        if (!sendAll(s, reply) || !recvLine(s, line) || line != "ACCEPTED") {
+            std::cout << "[Server] Takeover by process " << pid << " failed" << std::endl;
+            closesocket(s);
+            continue;
+        }
+
+        std::cout << "[Server] Handing over to process " << pid << std::endl;
+        g_takeoverSocket = s;
+        requestShutdown();
+        return;
     }
+}
 
-    std::cout << "[Thread " << std::this_thread::get_id() << "] Client disconnected" << std::endl;
+// Після drain: прибрати сокет керування і дозволити новому процесу завантажити стан
+void finishTakeover() {
+    SOCKET s = g_takeoverSocket.exchange(INVALID_SOCKET);
+    if (g_controlSocket != INVALID_SOCKET) {
+        closesocket(g_controlSocket);
+        g_controlSocket = INVALID_SOCKET;
+        std::error_code ec;
+        std::filesystem::remove(controlSocketPath(), ec);
+    }
+    if (s != INVALID_SOCKET) {
+        sendAll(s, "READY\n");
+        closesocket(s);
+    }
+}
 
-    if (!currentUser.empty()) {
-        std::lock_guard<std::mutex> lock(g_mutex);
+// --takeover: забрати слухаючі сокети у запущеного процесу і дочекатися, поки він збереже стан
+bool takeOverFrom(SOCKET& listenSocket, SOCKET& clusterSocket) {
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return false;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, controlSocketPath().c_str(), sizeof(addr.sun_path) - 1);
 
-        auto it = g_users.find(currentUser);
-        if (it != g_users.end()) {
-            it->second.online = false;
-            it->second.socket = INVALID_SOCKET;
+    std::string line;
+    bool ok = connect(s, (SOCKADDR*)&addr, sizeof(addr)) != SOCKET_ERROR &&
+              sendAll(s, "TAKEOVER:" + std::to_string(GetCurrentProcessId()) + "\n") &&
+              recvLine(s, line) && line.substr(0, 8) == "SOCKETS:";
+
+    size_t count = ok ? strtoul(line.substr(8).c_str(), nullptr, 10) : 0;
+    unsigned char ticketKeys[TICKET_KEYS_SIZE];
+    std::vector<WSAPROTOCOL_INFOW> sockets(count);
+    ok = ok && count >= 1 && count <= 2 &&
+         recvExact(s, (char*)ticketKeys, sizeof(ticketKeys)) &&
+         recvExact(s, (char*)sockets.data(), count * sizeof(WSAPROTOCOL_INFOW));
+
+    if (ok) {
+        listenSocket = WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &sockets[0], 0, 0);
+        if (count == 2) {
+            clusterSocket = WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &sockets[1], 0, 0);
         }
+        ok = listenSocket != INVALID_SOCKET && (count == 1 || clusterSocket != INVALID_SOCKET) &&
+             (count == 2) == isClusterEnabled();
+    }
+
+    // Після ACCEPTED старий процес закриває свої копії сокетів і виконує drain; READY - стан збережено.
+    // Без READY (старий процес впав під час drain) сокети вже наші - працюємо зі станом, що є на диску
+    ok = ok && sendAll(s, "ACCEPTED\n");
+    if (ok && !(recvLine(s, line) && line == "READY")) {
+        std::cout << "[Server] Previous process did not confirm drain" << std::endl;
+    }
+    closesocket(s);
 
-        g_socketToUser.erase(clientSocket);
+    if (ok) {
+        SSL_CTX_set_tlsext_ticket_keys(g_sslCtx, ticketKeys, sizeof(ticketKeys));
+    }
+    return ok;
+}
 
-        g_mutex.unlock();
-        broadcastUserList();
-        g_mutex.lock();
+void printUsage() {
+    std::cout << "Usage: server [--port N] [--max-conn-per-ip N] [--takeover] [--record FILE]" << std::endl;
+    std::cout << "              [--node-id ID --cluster-port N --cluster-secret S" << std::endl;
+    std::cout << "               --peers ID=HOST:PORT:CLUSTER_PORT,...]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Local cluster example (two nodes):" << std::endl;
+    std::cout << "  server --port 12345 --node-id 1 --cluster-port 13345 --cluster-secret s "
+                 "--peers 2=127.0.0.1:12346:13346" << std::endl;
+    std::cout << "  server --port 12346 --node-id 2 --cluster-port 13346 --cluster-secret s "
+                 "--peers 1=127.0.0.1:12345:13345" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Hot restart: start the new build with the same arguments plus --takeover." << std::endl;
+    std::cout << "It takes over the listening sockets from the running server, which then" << std::endl;
+    std::cout << "drains its clients, saves state and exits." << std::endl;
+    std::cout << std::endl;
+    std::cout << "--record FILE writes client commands and replies for replay in server_tests." << std::endl;
+}
+
+bool parseArguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--takeover") {
+            g_takeover = true;
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+
+        if (arg == "--port") {
+            g_clientPort = atoi(value.c_str());
+        } else if (arg == "--max-conn-per-ip") {
+            g_maxConnectionsPerIp = atoi(value.c_str());
+        } else if (arg == "--node-id") {
+            g_nodeId = atoi(value.c_str());
+        } else if (arg == "--cluster-port") {
+            g_clusterPort = atoi(value.c_str());
+        } else if (arg == "--cluster-secret") {
+            g_clusterSecret = value;
+        } else if (arg == "--record") {
+            g_recordFile.open(value, std::ios::out | std::ios::trunc);
+            if (!g_recordFile) return false;
+            g_recording = true;
+        } else if (arg == "--peers") {
+            std::stringstream specs(value);
+            std::string spec;
+            while (std::getline(specs, spec, ',')) {
+                ClusterNode node;
+                if (!parseClusterNode(spec, node)) return false;
+                g_nodes[node.id] = node;
+            }
+        } else {
+            return false;
+        }
     }
 
-    closesocket(clientSocket);
+    if (g_clientPort <= 0 || g_maxConnectionsPerIp <= 0) return false;
+    if (g_nodeId != 0 && (g_clusterPort <= 0 || g_nodes.empty() || g_nodes.count(g_nodeId) ||
+                          g_clusterSecret.empty())) {
+        return false;
+    }
+    return true;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (!parseArguments(argc, argv)) {
+        printUsage();
+        return 1;
+    }
+
     WSADATA wsaData;
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
         std::cout << "WSAStartup failed" << std::endl;
         return 1;
     }
 
-    SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (listenSocket == INVALID_SOCKET) {
-        std::cout << "Socket creation failed" << std::endl;
+    if (!initTls()) {
+        std::cout << "TLS initialization failed" << std::endl;
         WSACleanup();
         return 1;
     }
 
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(12345);
+    SOCKET listenSocket = INVALID_SOCKET;
+    SOCKET clusterSocket = INVALID_SOCKET;
+    if (g_takeover) {
+        if (!takeOverFrom(listenSocket, clusterSocket)) {
+            std::cout << "Takeover failed: no running server on " << controlSocketPath() << std::endl;
+            WSACleanup();
+            return 1;
+        }
+        std::cout << "[Server] Took over listening sockets from the previous process" << std::endl;
+    } else {
+        listenSocket = createListenSocket(g_clientPort);
+        if (listenSocket == INVALID_SOCKET) {
+            std::cout << "Bind/listen on port " << g_clientPort << " failed" << std::endl;
+            WSACleanup();
+            return 1;
+        }
+    }
 
-    if (bind(listenSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        std::cout << "Bind failed" << std::endl;
-        closesocket(listenSocket);
-        WSACleanup();
-        return 1;
+    if (!loadState()) {
+        std::cout << "[Server] " << stateFilePath() << " is corrupt, starting with empty state" << std::endl;
     }
 
-    if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
-        std::cout << "Listen failed" << std::endl;
-        closesocket(listenSocket);
-        WSACleanup();
-        return 1;
+    g_listenSocket = listenSocket;
+    SetConsoleCtrlHandler(consoleCtrlHandler, TRUE);
+
+    g_controlSocket = createControlSocket();
+    if (g_controlSocket != INVALID_SOCKET) {
+        std::thread(controlLoop).detach();
+    } else {
+        std::cout << "[Server] Control socket unavailable, hot restart disabled" << std::endl;
+    }
+
+    std::thread(timerLoop).detach();
+    std::thread(workerLoop).detach();
+    std::thread(transferPumpLoop).detach();
+    postWork(cleanupPartialUploads);
+
+    if (isClusterEnabled()) {
+        if (!initClusterTls()) {
+            std::cout << "Cluster TLS initialization failed" << std::endl;
+            closesocket(listenSocket);
+            WSACleanup();
+            return 1;
+        }
+        if (clusterSocket == INVALID_SOCKET) {
+            clusterSocket = createListenSocket(g_clusterPort);
+        }
+        if (clusterSocket == INVALID_SOCKET) {
+            std::cout << "Bind/listen on cluster port " << g_clusterPort << " failed" << std::endl;
+            closesocket(listenSocket);
+            WSACleanup();
+            return 1;
+        }
+
+        // Нова епоха на кожен запуск: вузли не сплутають наші номери кадрів з попередніми
+        std::mt19937_64 random(std::random_device{}());
+        do {
+            g_peerEpoch = random();
+        } while (g_peerEpoch == 0);
+
+        g_ring.addNode(g_nodeId);
+        for (const auto& pair : g_nodes) {
+            g_ring.addNode(pair.first);
+
+            auto link = std::make_unique<PeerLink>();
+            link->node = pair.second;
+            g_peerLinks[pair.first] = std::move(link);
+        }
+
+        for (auto& pair : g_peerLinks) {
+            std::thread(peerSenderLoop, pair.second.get()).detach();
+        }
+        g_clusterListenSocket = clusterSocket;
+        std::thread(clusterAcceptLoop, clusterSocket).detach();
+        scheduleTimer(PRESENCE_SYNC_TICKS, []() { postWork(presenceSyncTick); });
     }
 
     std::cout << "========================================" << std::endl;
     std::cout << "Corporate Messenger Server" << std::endl;
-    std::cout << "Running on port 12345" << std::endl;
+    std::cout << "Running on port " << g_clientPort << " (TLS)" << std::endl;
+    if (isClusterEnabled()) {
+        std::cout << "Cluster node " << g_nodeId << ", cluster port " << g_clusterPort
+                  << ", peers: " << g_nodes.size() << std::endl;
+    }
     std::cout << "========================================" << std::endl;
 
-    while (true) {
-        SOCKET clientSocket = accept(listenSocket, NULL, NULL);
+    while (!g_shuttingDown) {
+        sockaddr_storage address;
+        int addressLength = sizeof(address);
+        SOCKET clientSocket = accept(listenSocket, (sockaddr*)&address, &addressLength);
 
         if (clientSocket != INVALID_SOCKET) {
-            std::thread clientThread(handleClient, clientSocket);
+            std::string clientIp = peerAddress(address);
+            if (!admitConnection(clientIp)) {
+                // Закрити одразу: без TLS і без потоку - відмова майже нічого не коштує
+                closesocket(clientSocket);
+                continue;
+            }
+
+            std::thread clientThread(handleClient, clientSocket, clientIp);
             clientThread.detach();
         }
     }
 
-    closesocket(listenSocket);
+    drainServer();
+    finishTakeover();
+
+    {
+        std::lock_guard<std::mutex> lock(g_shutdownMutex);
+        g_drained = true;
+    }
+    g_shutdownCv.notify_all();
+
+    std::cout << "[Server] Stopped" << std::endl;
+    SSL_CTX_free(g_sslCtx);
     WSACleanup();
-    return 0;
+
+    // Потоки таймерів і кластера ще працюють - не руйнувати глобальні об'єкти під ними
+    std::quick_exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <openssl/evp.h>
+
+// Сховище вкладень, адресоване вмістом: файл зберігається як root/ab/abcdef...
+// де ім'я - SHA-256 вмісту. Однакові файли зберігаються один раз.
+// Незавершені завантаження лежать у root/tmp/<hash>.<власник>.part і дописуються
+// послідовно, тому перерване завантаження можна продовжити з того ж місця.
+// Частина належить тому, хто її надсилає: чужу частину не можна "дописати"
+// останнім шматком, а знання хешу не дає доступу до файлу без самих байтів.
+class BlobStore {
+public:
+    static const uint64_t CHUNK_SIZE = 64 * 1024;
+
+    enum FinishResult {
+        Incomplete,    // Отримано ще не всі байти
+        Stored,        // Вміст перевірено, блоб є в сховищі
+        HashMismatch,  // Вміст не відповідає хешу - частину видалено
+        StorageError   // Не вдалося перемістити у сховище - частину збережено для повторної спроби
+    };
+
+    explicit BlobStore(const std::string& rootDir = "blobs") : root(rootDir) {
+        std::error_code ec;
+        std::filesystem::create_directories(root / "tmp", ec);
+    }
+
+    // 64 hex-символи в нижньому регістрі - захищає від обходу шляхів
+    static bool isValidHash(const std::string& hash) {
+        if (hash.size() != 64) return false;
+        for (char c : hash) {
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+        }
+        return true;
+    }
+
+    std::filesystem::path path(const std::string& hash) const {
+        return root / hash.substr(0, 2) / hash;
+    }
+
+    bool exists(const std::string& hash) const {
+        std::error_code ec;
+        return std::filesystem::exists(path(hash), ec);
+    }
+
+    uint64_t size(const std::string& hash) const {
+        std::error_code ec;
+        uint64_t result = std::filesystem::file_size(path(hash), ec);
+        return ec ? 0 : result;
+    }
+
+    uint64_t partialSize(const std::string& hash, const std::string& owner) const {
+        std::error_code ec;
+        uint64_t result = std::filesystem::file_size(partPath(hash, owner), ec);
+        return ec ? 0 : result;
+    }
+
+    // Скільки байтів займають усі незавершені завантаження власника (для квоти)
+    uint64_t pendingBytes(const std::string& owner) const {
+        std::string suffix = "." + ownerTag(owner) + ".part";
+        uint64_t total = 0;
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(root / "tmp", ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                std::error_code sizeError;
+                uint64_t size = entry.file_size(sizeError);
+                if (!sizeError) total += size;
+            }
+        }
+        return total;
+    }
+
+    // Дописати шматок у незавершений блоб власника.
+    // Шматок, що вже є (повтор після перепідключення), ігнорується.
+    // Повертає новий розмір частини або -1, якщо offset не збігається з її кінцем.
+    int64_t append(const std::string& hash, const std::string& owner, uint64_t offset,
+                   const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(lockFor(hash));
+
+        uint64_t current = partialSize(hash, owner);
+        if (offset + length <= current) return (int64_t)current;
+        if (offset != current) return -1;
+
+        std::ofstream out(partPath(hash, owner), std::ios::binary | std::ios::app);
+        out.write(data, (std::streamsize)length);
+        if (!out) return -1;
+        return (int64_t)(current + length);
+    }
+
+    // Якщо від власника отримано expectedSize байт - перевірити SHA-256 і перемістити
+    // в сховище. Якщо такий блоб уже є, перевірена частина лише видаляється:
+    // власник довів, що має вміст.
+    FinishResult finish(const std::string& hash, const std::string& owner, uint64_t expectedSize) {
+        std::lock_guard<std::mutex> lock(lockFor(hash));
+
+        std::filesystem::path part = partPath(hash, owner);
+        uint64_t received = partialSize(hash, owner);
+        if (received < expectedSize) return Incomplete;
+
+        std::error_code ec;
+        if (received != expectedSize || sha256File(part) != hash) {
+            std::filesystem::remove(part, ec);
+            return HashMismatch;
+        }
+
+        if (exists(hash)) {
+            std::filesystem::remove(part, ec);
+            return Stored;
+        }
+
+        std::filesystem::create_directories(path(hash).parent_path(), ec);
+        if (!ec) std::filesystem::rename(part, path(hash), ec);
+        return ec ? StorageError : Stored;
+    }
+
+    // Видалити незавершені завантаження, які не дописувались довше за maxAge.
+    // Повертає кількість видалених частин.
+    size_t removeStalePartials(std::chrono::seconds maxAge) {
+        auto cutoff = std::filesystem::file_time_type::clock::now() - maxAge;
+        size_t removed = 0;
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(root / "tmp", ec)) {
+            std::lock_guard<std::mutex> lock(lockFor(entry.path().filename().string().substr(0, 64)));
+
+            // Час перевіряється під блокуванням: append міг щойно дописати цей файл
+            std::error_code timeError;
+            auto modified = std::filesystem::last_write_time(entry.path(), timeError);
+            if (timeError || modified >= cutoff) continue;
+
+            std::error_code removeError;
+            if (std::filesystem::remove(entry.path(), removeError)) removed++;
+        }
+        return removed;
+    }
+
+    static std::string sha256File(const std::filesystem::path& file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) return "";
+
+        EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+
+        char buffer[CHUNK_SIZE];
+        while (in) {
+            in.read(buffer, sizeof(buffer));
+            if (in.gcount() > 0) EVP_DigestUpdate(ctx, buffer, (size_t)in.gcount());
+        }
+
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLength = 0;
+        EVP_DigestFinal_ex(ctx, digest, &digestLength);
+        EVP_MD_CTX_free(ctx);
+
+        static const char* hex = "0123456789abcdef";
+        std::string result;
+        for (unsigned int i = 0; i < digestLength; i++) {
+            result += hex[digest[i] >> 4];
+            result += hex[digest[i] & 0x0f];
+        }
+        return result;
+    }
+
+private:
+    static const size_t LOCK_STRIPES = 64;
+
+    // Власник у імені файлу - hex, тож будь-яке ім'я користувача дає безпечний шлях
+    static std::string ownerTag(const std::string& owner) {
+        static const char* hex = "0123456789abcdef";
+        std::string tag;
+        for (unsigned char c : owner) {
+            tag += hex[c >> 4];
+            tag += hex[c & 0x0f];
+        }
+        return tag;
+    }
+
+    std::filesystem::path partPath(const std::string& hash, const std::string& owner) const {
+        return root / "tmp" / (hash + "." + ownerTag(owner) + ".part");
+    }
+
+    // Фіксований набір м'ютексів, вибраний за хешем: різні завантаження рідко
+    // блокують одне одного, а пам'ять не росте з кількістю файлів
+    std::mutex& lockFor(const std::string& hash) {
+        return locks[std::hash<std::string>()(hash) % LOCK_STRIPES];
+    }
+
+    std::filesystem::path root;
+    std::mutex locks[LOCK_STRIPES];
+};
+
+#endif // BLOBSTORE_H
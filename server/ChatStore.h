@@ -0,0 +1,111 @@
+#ifndef CHATSTORE_H
+#define CHATSTORE_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Ідентифікатор з'єднання клієнта (на сервері - значення SOCKET)
+using ConnectionId = uint64_t;
+const ConnectionId INVALID_CONNECTION = ~0ull;
+
+// Структура повідомлення
+struct Message {
+    std::string from;
+    std::string to;
+    std::string text;
+    std::string attachment;  // "sha256|size|filename" для вкладень, інакше порожньо
+    long long timestamp;
+};
+
+// Структура користувача
+struct User {
+    std::string username;
+    std::string passwordHash;  // Див. PasswordHash.h
+    std::string department;
+    bool online = false;
+    ConnectionId connection = INVALID_CONNECTION;
+};
+
+// Користувач, що належить іншому вузлу (відомий з gossip)
+struct RemoteUser {
+    std::string department;
+    bool online = false;
+    int nodeId = 0;
+};
+
+// Користувачі, історія повідомлень і права на вкладення.
+// Клас не потокобезпечний - на сервері всі звернення йдуть під g_mutex.
+class ChatStore {
+public:
+    std::map<std::string, User> users;                          // username -> User
+    std::vector<Message> messages;                              // Історія всіх повідомлень
+    std::map<std::string, std::set<std::string>> blobAccess;    // sha256 -> хто може завантажити
+
+    void addMessage(Message msg) {
+        // Вкладення можуть завантажувати лише учасники розмови
+        if (!msg.attachment.empty()) {
+            std::string hash = msg.attachment.substr(0, msg.attachment.find('|'));
+            blobAccess[hash].insert(msg.from);
+            blobAccess[hash].insert(msg.to);
+        }
+        messages.push_back(std::move(msg));
+    }
+
+    bool canDownload(const std::string& hash, const std::string& username) const {
+        auto it = blobAccess.find(hash);
+        return it != blobAccess.end() && it->second.count(username) > 0;
+    }
+
+    // Повідомлення між двома користувачами в порядку надходження
+    std::vector<const Message*> history(const std::string& user1, const std::string& user2) const {
+        std::vector<const Message*> result;
+        for (const Message& msg : messages) {
+            if ((msg.from == user1 && msg.to == user2) ||
+                (msg.from == user2 && msg.to == user1)) {
+                result.push_back(&msg);
+            }
+        }
+        return result;
+    }
+
+    // Кадр історії: текстове повідомлення або вкладення
+    static std::string historyPacket(const Message& msg) {
+        return msg.attachment.empty()
+            ? "MSG:" + msg.from + "|" + msg.text
+            : "FILE:" + msg.from + "|" + msg.attachment;
+    }
+
+    // USERS:username|department|online\n... - свої користувачі, потім користувачі інших вузлів
+    std::string userListPayload(const std::map<std::string, RemoteUser>& remoteUsers) const {
+        std::string result = "USERS:";
+
+        bool first = true;
+        for (const auto& pair : users) {
+            if (!first) result += '\n';
+            first = false;
+            appendUserLine(result, pair.first, pair.second.department, pair.second.online);
+        }
+
+        for (const auto& pair : remoteUsers) {
+            if (users.count(pair.first)) continue;
+            if (!first) result += '\n';
+            first = false;
+            appendUserLine(result, pair.first, pair.second.department, pair.second.online);
+        }
+        return result;
+    }
+
+private:
+    static void appendUserLine(std::string& out, const std::string& username,
+                               const std::string& department, bool online) {
+        out += username;
+        out += '|';
+        out += department;
+        out += online ? "|1" : "|0";
+    }
+};
+
+#endif // CHATSTORE_H
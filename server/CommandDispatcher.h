@@ -0,0 +1,700 @@
+#ifndef COMMANDDISPATCHER_H
+#define COMMANDDISPATCHER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BlobStore.h"
+#include "ChatStore.h"
+#include "DeliveryStateTable.h"
+#include "PasswordHash.h"
+#include "Protocol.h"
+#include "SequenceWindow.h"
+#include "TokenBucket.h"
+
+// Скільки вікон дублікатів зберігати (усього і на користувача)
+// і через скільки секунд неактивне вікно можна видалити
+const size_t MAX_DELIVERY_STATES = 100000;
+const size_t MAX_DELIVERY_STATES_PER_USER = 16;
+const time_t DELIVERY_STATE_TTL = 7 * 24 * 60 * 60;
+
+// Максимальний розмір вкладення і скільки місця можуть займати незавершені
+// відвантаження одного користувача
+const uint64_t MAX_ATTACHMENT_SIZE = 256ull * 1024 * 1024;
+const uint64_t MAX_PENDING_UPLOAD_BYTES = 1024ull * 1024 * 1024;
+
+// Обмеження частоти команд. Кожна команда належить до класу; для класу є відро
+// на з'єднання і відро на користувача, спільне для всіх його з'єднань.
+// Для REG/LOGIN відро користувача рахує лише невдалі спроби і належить парі
+// "ім'я з команди|IP": перебір паролів обмежено навіть тоді, коли кожна спроба
+// йде з нового з'єднання, але чужі помилки з інших адрес не блокують власника.
+enum CommandClass {
+    CMD_AUTH,       // REG, LOGIN
+    CMD_MESSAGE,    // MSG
+    CMD_QUERY,      // GET_USERS, GET_HISTORY, SESSION, UPLOAD, DOWNLOAD
+    CMD_EVENT,      // EVENT
+    CMD_TRANSFER,   // CHUNK
+    CMD_CONTROL,    // PING, PONG, LOGOUT і невідомі команди
+    COMMAND_CLASS_COUNT
+};
+
+struct RateLimit {
+    double burst;      // Скільки команд можна надіслати поспіль (0 - відра немає)
+    double perSecond;  // Швидкість поповнення відра
+};
+
+const RateLimit CONNECTION_RATE_LIMITS[COMMAND_CLASS_COUNT] = {
+    {5, 0.5}, {50, 20}, {20, 5}, {20, 5}, {256, 160}, {20, 10}
+};
+const RateLimit USER_RATE_LIMITS[COMMAND_CLASS_COUNT] = {
+    {10, 0.2}, {100, 30}, {40, 10}, {40, 10}, {512, 240}, {0, 0}
+};
+const size_t MAX_RATE_LIMITED_USERS = 100000;
+
+// Відра користувача, спільні для всіх його з'єднань. Сесія тримає посилання
+// з моменту входу, тож перевірка команди блокує лише м'ютекс цього користувача.
+struct UserRateState {
+    std::mutex mutex;
+    TokenBucket buckets[COMMAND_CLASS_COUNT];
+
+    UserRateState() {
+        for (int i = 0; i < COMMAND_CLASS_COUNT; i++) {
+            buckets[i] = TokenBucket(USER_RATE_LIMITS[i].burst, USER_RATE_LIMITS[i].perSecond);
+        }
+    }
+};
+
+// Стан сесії одного з'єднання
+struct ClientSession {
+    ConnectionId connection = INVALID_CONNECTION;
+    std::string address;                      // IP клієнта - ключ лімітів невдалих REG/LOGIN
+    std::string currentUser;
+    std::shared_ptr<UserRateState> userRate;  // Відра currentUser
+    std::shared_ptr<DeliveryState> delivery;  // nullptr - клієнт не надіслав SESSION
+    bool ackPending = false;                  // Потрібно надіслати ACK при наступному flush
+
+    // Незавершені відвантаження вкладень: sha256 -> що це за файл і кому
+    struct Upload {
+        std::string recipient;
+        std::string filename;
+        uint64_t size = 0;
+    };
+    std::map<std::string, Upload> uploads;
+
+    TokenBucket rateLimits[COMMAND_CLASS_COUNT];  // Відра з'єднання за класами команд
+    bool rateLimited = false;                     // Надіслати ERROR:Rate limited при наступному flush
+
+    explicit ClientSession(ConnectionId connection = INVALID_CONNECTION) : connection(connection) {
+        for (int i = 0; i < COMMAND_CLASS_COUNT; i++) {
+            rateLimits[i] = TokenBucket(CONNECTION_RATE_LIMITS[i].burst, CONNECTION_RATE_LIMITS[i].perSecond);
+        }
+    }
+};
+
+// Все, що обробці команд потрібно від мережевого рівня: черги з'єднань, кластер,
+// онлайн-індекс і насос передачі файлів. Сервер реалізує це поверх сокетів і TLS,
+// тести - записом у пам'ять, тому команди можна проганяти без мережі.
+class ServerHooks {
+public:
+    virtual ~ServerHooks() = default;
+
+    virtual uint64_t nowMillis() = 0;                                     // Монотонний час для лімітів
+    virtual void send(ConnectionId connection, const std::string& msg) = 0;  // Поставити кадр у чергу
+    virtual bool redirectIfRemote(ConnectionId connection, const std::string& username) = 0;
+    virtual void presenceChanged(const User& user) = 0;                  // Викликається під м'ютексом чату
+    virtual void sendUserList(ConnectionId connection) = 0;
+    virtual void broadcastUserList() = 0;
+    virtual void routeEvent(const std::string& from, const std::string& to,
+                            const std::string& kind, const std::string& value) = 0;
+    virtual void forwardMessage(const std::string& from, const std::string& to, const std::string& text) = 0;
+    virtual void forwardAttachment(const std::string& from, const std::string& to, const std::string& attachment) = 0;
+    virtual bool startDownload(ConnectionId connection, const std::string& hash, uint64_t offset) = 0;
+};
+
+// Обробка команд клієнта, відокремлена від сокетів.
+// process() викликається для кожного кадру, finishBatch() - після пачки кадрів з одного recv().
+class CommandDispatcher {
+public:
+    CommandDispatcher(ChatStore& chat, std::mutex& chatMutex, BlobStore& blobs, ServerHooks& hooks,
+                      std::ostream& log = std::cout)
+        : chat(chat), chatMutex(chatMutex), blobs(blobs), hooks(hooks), log(log) {}
+
+    void process(ClientSession& session, const std::string& data) {
+        // Обмеження частоти - до будь-якої іншої роботи і до м'ютекса чату.
+        // Відповідь ERROR:Rate limited одна на всю пачку відхилених команд (див. finishBatch)
+        CommandClass commandClass = classifyCommand(data);
+        if (!allowCommand(session, commandClass, data)) {
+            session.rateLimited = true;
+            return;
+        }
+
+        if (commandClass == CMD_AUTH) {
+            log << "[Client] " << data.substr(0, data.find('|')) << "|***" << std::endl;  // Без пароля
+        } else if (commandClass != CMD_TRANSFER) {
+            log << "[Client] " << data.substr(0, 100) << std::endl;
+        }
+
+        std::string_view command(data);
+        size_t colonPos = command.find(':');
+        if (colonPos == std::string_view::npos) {
+            if (command == "PING") {
+                hooks.send(session.connection, "PONG");
+            } else if (command == "PONG") {
+                // Активність вже врахована при отриманні даних
+            } else if (command == "GET_USERS") {
+                hooks.sendUserList(session.connection);
+            } else if (command == "LOGOUT") {
+                logout(session);
+            }
+            return;
+        }
+
+        std::string_view name = command.substr(0, colonPos);
+        std::string_view payload = command.substr(colonPos + 1);
+
+        if (name == "REG") handleRegister(session, payload);
+        else if (name == "LOGIN") handleLogin(session, payload);
+        else if (name == "EVENT") handleEvent(session, payload);
+        else if (name == "GET_HISTORY") handleHistory(session, payload);
+        else if (name == "SESSION") handleSession(session, payload);
+        else if (name == "MSG" && session.delivery) handleSequencedMessage(session, payload);
+        else if (name == "MSG") handleMessage(session, payload);
+        else if (name == "UPLOAD") handleUpload(session, payload);
+        else if (name == "CHUNK") handleChunk(session, payload);
+        else if (name == "DOWNLOAD") handleDownload(session, payload);
+    }
+
+    // Після пачки команд: одне кумулятивне ACK замість відповіді на кожне повідомлення
+    // і одна відповідь на всі відхилені лімітом команди
+    void finishBatch(ClientSession& session) {
+        if (session.ackPending && session.delivery) {
+            uint64_t acked;
+            {
+                std::lock_guard<std::mutex> lock(session.delivery->mutex);
+                acked = session.delivery->window.highestContiguous();
+            }
+            hooks.send(session.connection, "ACK:" + std::to_string(acked));
+            session.ackPending = false;
+        }
+
+        if (session.rateLimited) {
+            hooks.send(session.connection, "ERROR:Rate limited");
+            session.rateLimited = false;
+        }
+    }
+
+    // Вихід користувача - команда LOGOUT або розрив з'єднання
+    void logout(ClientSession& session) {
+        if (session.currentUser.empty()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+            auto it = chat.users.find(session.currentUser);
+            if (it != chat.users.end()) {
+                it->second.online = false;
+                it->second.connection = INVALID_CONNECTION;
+                hooks.presenceChanged(it->second);
+            }
+        }
+
+        log << "[Server] Logged out: " << session.currentUser << std::endl;
+        session.currentUser.clear();
+        session.userRate.reset();
+        session.delivery.reset();
+        session.uploads.clear();
+
+        hooks.broadcastUserList();
+    }
+
+    // Клас команди для обмеження частоти (порівняння без копіювання - CHUNK великі)
+    static CommandClass classifyCommand(const std::string& data) {
+        if (startsWith(data, "CHUNK:")) return CMD_TRANSFER;
+        if (startsWith(data, "MSG:")) return CMD_MESSAGE;
+        if (startsWith(data, "EVENT:")) return CMD_EVENT;
+        if (startsWith(data, "REG:") || startsWith(data, "LOGIN:")) return CMD_AUTH;
+        if (data == "GET_USERS" || startsWith(data, "GET_HISTORY:") || startsWith(data, "SESSION:") ||
+            startsWith(data, "UPLOAD:") || startsWith(data, "DOWNLOAD:")) {
+            return CMD_QUERY;
+        }
+        return CMD_CONTROL;
+    }
+
+    // Вікна дублікатів "username|clientId" - відкриті для збереження стану сервера
+    DeliveryStateTable deliveryStates{MAX_DELIVERY_STATES, MAX_DELIVERY_STATES_PER_USER, DELIVERY_STATE_TTL};
+
+    // Вартість хешування паролів нових користувачів (фазер зменшує, щоб не гальмувати)
+    int passwordIterations = PASSWORD_HASH_ITERATIONS;
+
+private:
+    // === РЕЄСТРАЦІЯ: REG:username|password|department ===
+    void handleRegister(ClientSession& session, std::string_view payload) {
+        std::string_view fields[3];
+        if (!splitFields(payload, 3, fields)) {
+            hooks.send(session.connection, "ERROR:Invalid registration format");
+            return;
+        }
+
+        if (!isValidName(fields[0]) || !isValidName(fields[2])) {
+            hooks.send(session.connection, "ERROR:Invalid registration format");
+            return;
+        }
+
+        std::string username(fields[0]);
+        if (hooks.redirectIfRemote(session.connection, username)) {
+            return;
+        }
+
+        // Хешування навмисно повільне - до м'ютекса чату
+        std::string passwordHash = hashPassword(fields[1], passwordIterations);
+        if (passwordHash.empty()) {
+            hooks.send(session.connection, "ERROR:Registration failed");
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(chatMutex);
+
+        if (chat.users.find(username) != chat.users.end()) {
+            chargeAuthFailure(session, username);
+            hooks.send(session.connection, "ERROR:User already exists");
+            return;
+        }
+
+        User& newUser = chat.users[username];
+        newUser.username = username;
+        newUser.passwordHash = std::move(passwordHash);
+        newUser.department = std::string(fields[2]);
+        hooks.presenceChanged(newUser);
+
+        log << "[Server] Registered: " << username << " (" << newUser.department << ")" << std::endl;
+        hooks.send(session.connection, "OK:Registered");
+    }
+
+    // === ЛОГІН: LOGIN:username|password ===
+    void handleLogin(ClientSession& session, std::string_view payload) {
+        std::string_view fields[2];
+        if (!splitFields(payload, 2, fields)) {
+            hooks.send(session.connection, "ERROR:Invalid login format");
+            return;
+        }
+
+        // Одне з'єднання - один користувач: інакше перший лишився б онлайн після розриву
+        if (!session.currentUser.empty()) {
+            hooks.send(session.connection, "ERROR:Already logged in");
+            return;
+        }
+
+        std::string username(fields[0]);
+        if (hooks.redirectIfRemote(session.connection, username)) {
+            return;
+        }
+
+        // Пароль перевіряється без м'ютекса чату (PBKDF2 повільний); користувачі не видаляються,
+        // тож після перевірки запис лише шукається знову
+        std::string passwordHash;
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+
+            auto it = chat.users.find(username);
+            if (it == chat.users.end()) {
+                chargeAuthFailure(session, username);
+                hooks.send(session.connection, "ERROR:User not found");
+                return;
+            }
+            passwordHash = it->second.passwordHash;
+        }
+        if (!verifyPassword(fields[1], passwordHash)) {
+            chargeAuthFailure(session, username);
+            hooks.send(session.connection, "ERROR:Wrong password");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+
+            auto it = chat.users.find(username);
+            if (it->second.online) {
+                hooks.send(session.connection, "ERROR:User already logged in");
+                return;
+            }
+
+            it->second.online = true;
+            it->second.connection = session.connection;
+            session.currentUser = username;
+            session.delivery.reset();
+            hooks.presenceChanged(it->second);
+        }
+        session.userRate = userRateState(username);
+
+        log << "[Server] Logged in: " << username << std::endl;
+
+        hooks.send(session.connection, "OK:Logged in");
+        hooks.sendUserList(session.connection);
+        hooks.broadcastUserList();
+    }
+
+    // === ЕФЕМЕРНА ПОДІЯ: EVENT:recipient|kind|value ===
+    // Не зберігається і не підтверджується; kind - typing або viewing, value - 0 або 1
+    void handleEvent(ClientSession& session, std::string_view payload) {
+        std::string_view fields[3];
+        if (session.currentUser.empty() || !splitFields(payload, 3, fields) || fields[0].size() > MAX_NAME_LENGTH) return;
+
+        if ((fields[1] == "typing" || fields[1] == "viewing") && (fields[2] == "0" || fields[2] == "1")) {
+            hooks.routeEvent(session.currentUser, std::string(fields[0]), std::string(fields[1]), std::string(fields[2]));
+        }
+    }
+
+    // === ЗАПИТ ІСТОРІЇ: GET_HISTORY:username ===
+    void handleHistory(ClientSession& session, std::string_view payload) {
+        if (session.currentUser.empty()) return;
+
+        std::string otherUser(payload);
+        log << "[Server] Sending chat history: " << session.currentUser << " <-> " << otherUser << std::endl;
+
+        std::vector<std::string> packets;
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+            for (const Message* msg : chat.history(session.currentUser, otherUser)) {
+                packets.push_back(ChatStore::historyPacket(*msg));
+            }
+        }
+        for (const std::string& packet : packets) {
+            hooks.send(session.connection, packet);
+        }
+    }
+
+    // === СЕСІЯ ДОСТАВКИ: SESSION:clientId ===
+    // Відповідь SESSION:N - усі повідомлення з номерами до N включно вже прийняті
+    void handleSession(ClientSession& session, std::string_view clientId) {
+        if (session.currentUser.empty() || clientId.empty() || clientId.size() > MAX_NAME_LENGTH) {
+            hooks.send(session.connection, "ERROR:Not logged in or invalid format");
+            return;
+        }
+
+        session.delivery = deliveryStates.find(session.currentUser, std::string(clientId), time(nullptr));
+
+        uint64_t acked;
+        {
+            std::lock_guard<std::mutex> lock(session.delivery->mutex);
+            acked = session.delivery->window.highestContiguous();
+        }
+        hooks.send(session.connection, "SESSION:" + std::to_string(acked));
+    }
+
+    // === ПОВІДОМЛЕННЯ З НОМЕРОМ: MSG:seq|recipient|text (після SESSION) ===
+    void handleSequencedMessage(ClientSession& session, std::string_view payload) {
+        std::string_view fields[3];
+        if (!splitFields(payload, 3, fields) || session.currentUser.empty()) {
+            hooks.send(session.connection, "ERROR:Not logged in or invalid format");
+            return;
+        }
+
+        uint64_t seq = strtoull(std::string(fields[0]).c_str(), nullptr, 10);
+        std::string recipient(fields[1]);
+        std::string text(fields[2]);
+
+        SequenceWindow::Result result;
+        {
+            std::lock_guard<std::mutex> lock(session.delivery->mutex);
+            result = session.delivery->window.accept(seq);
+            session.delivery->lastUsed = time(nullptr);
+        }
+
+        if (result == SequenceWindow::OutOfWindow) {
+            hooks.send(session.connection, "ERROR:Sequence out of window");
+            return;
+        }
+
+        // Номер зараховано, щоб повтори не зупиняли потік, але повідомлення не пересилається
+        if (result == SequenceWindow::Accepted && !isDeliverable(recipient, text)) {
+            hooks.send(session.connection, "ERROR:Message too long");
+        } else if (result == SequenceWindow::Accepted) {
+            log << "[Message] " << session.currentUser << " -> " << recipient << " #" << seq << ": " << text << std::endl;
+            hooks.forwardMessage(session.currentUser, recipient, text);
+        } else {
+            log << "[Message] Duplicate #" << seq << " from " << session.currentUser << " suppressed" << std::endl;
+        }
+
+        // ACK надсилається один раз на пачку команд - див. finishBatch
+        session.ackPending = true;
+    }
+
+    // === ПОВІДОМЛЕННЯ: MSG:recipient|text ===
+    void handleMessage(ClientSession& session, std::string_view payload) {
+        std::string_view fields[2];
+        if (!splitFields(payload, 2, fields) || session.currentUser.empty()) {
+            hooks.send(session.connection, "ERROR:Not logged in or invalid format");
+            return;
+        }
+
+        std::string recipient(fields[0]);
+        std::string text(fields[1]);
+        if (!isDeliverable(recipient, text)) {
+            hooks.send(session.connection, "ERROR:Message too long");
+            return;
+        }
+        log << "[Message] " << session.currentUser << " -> " << recipient << ": " << text << std::endl;
+
+        hooks.forwardMessage(session.currentUser, recipient, text);
+        hooks.send(session.connection, "OK:Sent");
+    }
+
+    // === ВКЛАДЕННЯ: UPLOAD:recipient|sha256|size|filename ===
+    // Відповідь UPLOAD_RESUME:sha256|offset - з якого місця надсилати CHUNK,
+    // або одразу UPLOAD_DONE, якщо користувач уже має доступ до цього файлу.
+    // Без доступу байти потрібні навіть для файлу, що вже є в сховищі: інакше
+    // знання хешу відкривало б чужий файл.
+    void handleUpload(ClientSession& session, std::string_view payload) {
+        std::string_view fields[4];
+        if (session.currentUser.empty() || !splitFields(payload, 4, fields)) {
+            hooks.send(session.connection, "ERROR:Not logged in or invalid format");
+            return;
+        }
+
+        ClientSession::Upload upload;
+        upload.recipient = std::string(fields[0]);
+        std::string hash(fields[1]);
+        upload.size = strtoull(std::string(fields[2]).c_str(), nullptr, 10);
+        upload.filename = std::string(fields[3]);
+
+        if (!BlobStore::isValidHash(hash) || upload.filename.empty() ||
+            upload.filename.size() > MAX_FILENAME_LENGTH || upload.recipient.size() > MAX_NAME_LENGTH) {
+            hooks.send(session.connection, "ERROR:Invalid attachment");
+            return;
+        }
+        if (upload.size > MAX_ATTACHMENT_SIZE) {
+            hooks.send(session.connection, "ERROR:Attachment too large");
+            return;
+        }
+
+        bool known;
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+            known = chat.canDownload(hash, session.currentUser);
+        }
+        if (known && blobs.exists(hash)) {
+            // Розмір - справжній розмір блоба, а не заявлений клієнтом
+            upload.size = blobs.size(hash);
+            forwardUpload(session, hash, upload);
+            return;
+        }
+
+        // Квота - байти на диску плюс ще не отримані байти всіх заявлених відвантажень сесії:
+        // інакше багато заявок без жодного шматка пройшли б перевірку кожна окремо
+        uint64_t received = blobs.partialSize(hash, session.currentUser);
+        uint64_t reserved = blobs.pendingBytes(session.currentUser) - received + upload.size;
+        for (const auto& pair : session.uploads) {
+            if (pair.first == hash) continue;
+            uint64_t partial = blobs.partialSize(pair.first, session.currentUser);
+            if (pair.second.size > partial) reserved += pair.second.size - partial;
+        }
+        if (reserved > MAX_PENDING_UPLOAD_BYTES) {
+            hooks.send(session.connection, "ERROR:Too many unfinished uploads");
+            return;
+        }
+
+        session.uploads[hash] = upload;
+        if (!completeUpload(session, hash)) {
+            hooks.send(session.connection, "UPLOAD_RESUME:" + hash + "|" + std::to_string(received));
+        }
+    }
+
+    // === ШМАТОК ВКЛАДЕННЯ: CHUNK:sha256|offset|дані ===
+    void handleChunk(ClientSession& session, std::string_view payload) {
+        std::string_view fields[3];
+        if (!splitFields(payload, 3, fields)) {
+            hooks.send(session.connection, "ERROR:Invalid format");
+            return;
+        }
+
+        std::string hash(fields[0]);
+        uint64_t offset = strtoull(std::string(fields[1]).c_str(), nullptr, 10);
+        std::string_view data = fields[2];
+
+        auto it = session.uploads.find(hash);
+        if (it == session.uploads.end()) {
+            hooks.send(session.connection, "ERROR:Unknown upload");
+            return;
+        }
+
+        if (offset + data.size() > it->second.size) {
+            hooks.send(session.connection, "ERROR:Chunk exceeds attachment size");
+            return;
+        }
+
+        int64_t written = blobs.append(hash, session.currentUser, offset, data.data(), data.size());
+        if (written < 0) {
+            // Розсинхронізація (наприклад, після перепідключення) - повідомити справжній зсув
+            hooks.send(session.connection, "UPLOAD_RESUME:" + hash + "|" +
+                                           std::to_string(blobs.partialSize(hash, session.currentUser)));
+            return;
+        }
+
+        if (!completeUpload(session, hash)) {
+            hooks.send(session.connection, "UPLOAD_ACK:" + hash + "|" + std::to_string(written));
+        }
+    }
+
+    // === ЗАВАНТАЖЕННЯ ВКЛАДЕННЯ: DOWNLOAD:sha256|offset ===
+    // Дані приходять кадрами FILE_CHUNK:sha256|offset|дані
+    void handleDownload(ClientSession& session, std::string_view payload) {
+        size_t pos = payload.find('|');
+        std::string hash(payload.substr(0, pos));
+        uint64_t offset = pos == std::string_view::npos
+            ? 0 : strtoull(std::string(payload.substr(pos + 1)).c_str(), nullptr, 10);
+
+        bool allowed = false;
+        if (!session.currentUser.empty() && BlobStore::isValidHash(hash)) {
+            std::lock_guard<std::mutex> lock(chatMutex);
+            allowed = chat.canDownload(hash, session.currentUser);
+        }
+
+        if (!allowed || !hooks.startDownload(session.connection, hash, offset)) {
+            hooks.send(session.connection, "ERROR:Attachment not available");
+        }
+    }
+
+    // Чи вміститься повідомлення в кадри, які з нього будуються (FWD до іншого вузла, MSG одержувачу)
+    static bool isDeliverable(const std::string& recipient, const std::string& text) {
+        return recipient.size() <= MAX_NAME_LENGTH && text.size() <= MAX_MESSAGE_TEXT;
+    }
+
+    // Якщо всі байти вкладення отримано - перевірити хеш і переслати одержувачу.
+    // Повертає false, поки відвантаження не завершене.
+    bool completeUpload(ClientSession& session, const std::string& hash) {
+        auto it = session.uploads.find(hash);
+        if (it == session.uploads.end()) return true;
+
+        const ClientSession::Upload& upload = it->second;
+        BlobStore::FinishResult result = blobs.finish(hash, session.currentUser, upload.size);
+        if (result == BlobStore::Incomplete) return false;
+
+        if (result == BlobStore::HashMismatch) {
+            hooks.send(session.connection, "ERROR:Attachment hash mismatch");
+        } else if (result == BlobStore::StorageError) {
+            // Усі байти лишаються на сервері: повторний UPLOAD лише ще раз спробує зберегти
+            log << "[File] Cannot store " << hash << std::endl;
+            hooks.send(session.connection, "ERROR:Attachment storage failed|" + hash);
+        } else {
+            forwardUpload(session, hash, upload);
+        }
+
+        session.uploads.erase(it);
+        return true;
+    }
+
+    // Переслати перевірене вкладення одержувачу (size - справжній розмір блоба)
+    void forwardUpload(ClientSession& session, const std::string& hash, const ClientSession::Upload& upload) {
+        log << "[File] " << session.currentUser << " -> " << upload.recipient << ": "
+            << upload.filename << " (" << upload.size << " bytes)" << std::endl;
+
+        std::string attachment = hash + "|" + std::to_string(upload.size) + "|" + upload.filename;
+        hooks.forwardAttachment(session.currentUser, upload.recipient, attachment);
+        hooks.send(session.connection, "UPLOAD_DONE:" + hash);
+    }
+
+    // Забути відра, які давно не використовувались, якщо їх забагато (наприклад,
+    // перебір випадкових імен у LOGIN). Викликається під rateMutex.
+    template <typename Map, typename IsIdle>
+    void sweepRateStates(Map& states, uint64_t now, IsIdle isIdle) {
+        if (states.size() < MAX_RATE_LIMITED_USERS || now - lastRateSweepMs < 1000) return;
+
+        lastRateSweepMs = now;
+        for (auto it = states.begin(); it != states.end();) {
+            if (isIdle(it->second)) it = states.erase(it);
+            else ++it;
+        }
+    }
+
+    // Спільні відра користувача; викликається лише під час входу.
+    // Відра, які тримає хоча б одна сесія, не забуваються.
+    std::shared_ptr<UserRateState> userRateState(const std::string& username) {
+        uint64_t now = hooks.nowMillis();
+        std::lock_guard<std::mutex> lock(rateMutex);
+
+        auto it = userRates.find(username);
+        if (it != userRates.end()) return it->second;
+
+        sweepRateStates(userRates, now, [now](std::shared_ptr<UserRateState>& state) {
+            if (state.use_count() > 1) return false;
+            std::lock_guard<std::mutex> stateLock(state->mutex);
+            for (TokenBucket& bucket : state->buckets) {
+                if (!bucket.isFull(now)) return false;
+            }
+            return true;
+        });
+
+        auto state = std::make_shared<UserRateState>();
+        if (userRates.size() < MAX_RATE_LIMITED_USERS) userRates[username] = state;
+        return state;
+    }
+
+    // Невдала спроба REG/LOGIN: забрати токен з відра пари "ім'я|IP".
+    // Якщо пар забагато і забути нікого не вдалось - лишається ліміт з'єднання.
+    void chargeAuthFailure(const ClientSession& session, const std::string& username) {
+        uint64_t now = hooks.nowMillis();
+        std::lock_guard<std::mutex> lock(rateMutex);
+
+        std::string key = username + "|" + session.address;
+        auto it = authFailures.find(key);
+        if (it == authFailures.end()) {
+            sweepRateStates(authFailures, now, [now](TokenBucket& bucket) { return bucket.isFull(now); });
+            if (authFailures.size() >= MAX_RATE_LIMITED_USERS) return;
+
+            it = authFailures.emplace(key, TokenBucket(USER_RATE_LIMITS[CMD_AUTH].burst,
+                                                       USER_RATE_LIMITS[CMD_AUTH].perSecond)).first;
+        }
+        it->second.tryConsume(now);
+    }
+
+    // Чи лишились у пари "ім'я|IP" спроби після попередніх невдач
+    bool authAllowed(const ClientSession& session, const std::string& data, uint64_t now) {
+        size_t start = data.find(':') + 1;
+        size_t end = data.find('|', start);
+        std::string key = data.substr(start, end == std::string::npos ? std::string::npos : end - start) +
+                          "|" + session.address;
+
+        std::lock_guard<std::mutex> lock(rateMutex);
+        auto it = authFailures.find(key);
+        return it == authFailures.end() || it->second.canConsume(now);
+    }
+
+    // Перевірка перед обробкою команди: відро з'єднання і відро користувача.
+    // Токен з відра з'єднання забирається лише тоді, коли команду пропускають обидва.
+    bool allowCommand(ClientSession& session, CommandClass commandClass, const std::string& data) {
+        uint64_t now = hooks.nowMillis();
+        TokenBucket& connectionBucket = session.rateLimits[commandClass];
+        if (!connectionBucket.canConsume(now)) return false;
+
+        if (commandClass == CMD_AUTH) {
+            if (!authAllowed(session, data, now)) return false;
+        } else if (session.userRate && USER_RATE_LIMITS[commandClass].burst > 0) {
+            std::lock_guard<std::mutex> lock(session.userRate->mutex);
+            if (!session.userRate->buckets[commandClass].tryConsume(now)) return false;
+        }
+
+        connectionBucket.tryConsume(now);
+        return true;
+    }
+
+    ChatStore& chat;
+    std::mutex& chatMutex;
+    BlobStore& blobs;
+    ServerHooks& hooks;
+    std::ostream& log;
+
+    // Під rateMutex; на шляху звичайних команд не потрібні - сесія тримає свої відра
+    std::map<std::string, std::shared_ptr<UserRateState>> userRates;  // username -> відра
+    std::map<std::string, TokenBucket> authFailures;                    // "username|IP" -> невдалі спроби
+    std::mutex rateMutex;
+    uint64_t lastRateSweepMs = 0;
+};
+
+#endif // COMMANDDISPATCHER_H
@@ -0,0 +1,167 @@
+#ifndef DELIVERYSTATETABLE_H
+#define DELIVERYSTATETABLE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <ctime>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "SequenceWindow.h"
+
+// Стан доставки для пари (користувач, clientId).
+// Живе довше за TCP-з'єднання, тому повторна відправка після перепідключення
+// не створює дублікатів.
+struct DeliveryState {
+    std::mutex mutex;
+    SequenceWindow window;
+    time_t lastUsed = 0;
+};
+
+// Вікна дублікатів "username|clientId" з обмеженим розміром.
+// Записи впорядковані за останнім використанням (LRU): прострочені й зайві прибираються
+// з хвоста списку, тому SESSION коштує O(1) незалежно від розміру таблиці.
+// Одному користувачу - не більше perUserLimit вікон: новий clientId витісняє його
+// найдавніше вікно, і клієнт з випадковими SESSION не заповнить таблицю для всіх.
+class DeliveryStateTable {
+public:
+    DeliveryStateTable(size_t capacity, size_t perUserLimit, time_t ttl)
+        : capacity(capacity), perUserLimit(perUserLimit), ttl(ttl) {}
+
+    // Вікно для пари; створюється, якщо його ще немає
+    std::shared_ptr<DeliveryState> find(const std::string& username, const std::string& clientId, time_t now) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(username + "|" + clientId);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            it->second->touched = now;
+            return it->second->state;
+        }
+
+        auto state = std::make_shared<DeliveryState>();
+        state->lastUsed = now;
+        insertLocked(username, clientId, state, now);
+        return state;
+    }
+
+    // Вікно зі збереженого стану; викликати від найдавніше використаних до найновіших
+    void restore(const std::string& key, std::shared_ptr<DeliveryState> state) {
+        size_t pos = key.find('|');
+        if (pos == std::string::npos) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index.count(key)) return;
+        time_t lastUsed = state->lastUsed;
+        insertLocked(key.substr(0, pos), key.substr(pos + 1), std::move(state), lastUsed);
+    }
+
+    // Усі вікна для збереження, від найдавніше використаних до найновіших
+    std::vector<std::pair<std::string, std::shared_ptr<DeliveryState>>> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::pair<std::string, std::shared_ptr<DeliveryState>>> result;
+        result.reserve(lru.size());
+        for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+            result.emplace_back(it->key, it->state);
+        }
+        return result;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+
+private:
+    struct Entry {
+        std::string username;
+        std::string key;
+        std::shared_ptr<DeliveryState> state;
+        time_t touched = 0;  // Останній SESSION (MSG оновлюють state->lastUsed)
+    };
+    using EntryIt = std::list<Entry>::iterator;
+
+    // Час останнього використання: SESSION або повідомлення з номером
+    static time_t lastActivity(const Entry& entry) {
+        std::lock_guard<std::mutex> stateLock(entry.state->mutex);
+        return std::max(entry.touched, entry.state->lastUsed);
+    }
+
+    void insertLocked(const std::string& username, const std::string& clientId,
+                      std::shared_ptr<DeliveryState> state, time_t now) {
+        expireLocked(now);
+
+        std::vector<EntryIt>& own = byUser[username];
+        if (own.size() >= perUserLimit) {
+            EntryIt oldest = own.front();
+            for (EntryIt candidate : own) {
+                if (lastActivity(*candidate) < lastActivity(*oldest)) oldest = candidate;
+            }
+            eraseLocked(oldest);
+        }
+        while (!lru.empty() && index.size() >= capacity) {
+            eraseLocked(std::prev(lru.end()));
+        }
+
+        Entry entry;
+        entry.username = username;
+        entry.key = username + "|" + clientId;
+        entry.state = std::move(state);
+        entry.touched = now;
+        lru.push_front(std::move(entry));
+
+        index[lru.front().key] = lru.begin();
+        byUser[username].push_back(lru.begin());
+    }
+
+    // Прибрати прострочені вікна з хвоста. Вікно, яким користувались через MSG після
+    // останнього SESSION, не видаляється, а переноситься на початок - кожен запис
+    // переноситься не частіше, ніж ним користуються, тож вартість амортизовано O(1).
+    void expireLocked(time_t now) {
+        while (!lru.empty()) {
+            EntryIt last = std::prev(lru.end());
+            if (now - last->touched <= ttl) break;
+
+            time_t active = lastActivity(*last);
+            if (now - active <= ttl) {
+                last->touched = active;
+                lru.splice(lru.begin(), lru, last);
+            } else {
+                eraseLocked(last);
+            }
+        }
+    }
+
+    void eraseLocked(EntryIt entry) {
+        auto user = byUser.find(entry->username);
+        if (user != byUser.end()) {
+            std::vector<EntryIt>& own = user->second;
+            for (size_t i = 0; i < own.size(); i++) {
+                if (own[i] == entry) {
+                    own.erase(own.begin() + (std::ptrdiff_t)i);
+                    break;
+                }
+            }
+            if (own.empty()) byUser.erase(user);
+        }
+        index.erase(entry->key);
+        lru.erase(entry);
+    }
+
+    const size_t capacity;
+    const size_t perUserLimit;
+    const time_t ttl;
+
+    std::mutex mutex;
+    std::list<Entry> lru;                                    // Початок - щойно використані
+    std::unordered_map<std::string, EntryIt> index;          // "username|clientId" -> запис
+    std::unordered_map<std::string, std::vector<EntryIt>> byUser;
+};
+
+#endif // DELIVERYSTATETABLE_H
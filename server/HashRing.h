@@ -0,0 +1,52 @@
+#ifndef HASHRING_H
+#define HASHRING_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Кільце консистентного хешування: користувач -> вузол кластера.
+// Кожен вузол має VIRTUAL_NODES точок на кільці, тому користувачі розподіляються
+// рівномірно, а при додаванні/видаленні вузла переїжджає лише ~1/N користувачів.
+// Хеш-функція фіксована (FNV-1a), щоб усі вузли обчислювали однакове кільце.
+class HashRing {
+public:
+    static const int VIRTUAL_NODES = 128;
+
+    void addNode(int nodeId) {
+        for (int i = 0; i < VIRTUAL_NODES; i++) {
+            ring[hash(std::to_string(nodeId) + "#" + std::to_string(i))] = nodeId;
+        }
+    }
+
+    bool empty() const { return ring.empty(); }
+
+    // Вузол-власник ключа: перша точка кільця за годинниковою стрілкою
+    int ownerOf(const std::string& key) const {
+        if (ring.empty()) return -1;
+
+        auto it = ring.lower_bound(hash(key));
+        if (it == ring.end()) it = ring.begin();
+        return it->second;
+    }
+
+    static uint64_t hash(const std::string& key) {
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        // Фіналізатор (splitmix64) - краще перемішування для коротких ключів
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+
+private:
+    std::map<uint64_t, int> ring;  // точка на кільці -> nodeId
+};
+
+#endif // HASHRING_H
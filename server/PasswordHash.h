@@ -0,0 +1,72 @@
+#ifndef PASSWORDHASH_H
+#define PASSWORDHASH_H
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+// Паролі зберігаються лише як PBKDF2-HMAC-SHA256 з випадковою сіллю:
+// "pbkdf2-sha256$ітерації$сіль$хеш" (сіль і хеш - hex). Файл стану без паролів
+// у відкритому вигляді, а однакові паролі різних користувачів дають різні записи.
+
+const int PASSWORD_HASH_ITERATIONS = 100000;
+const size_t PASSWORD_SALT_SIZE = 16;
+const size_t PASSWORD_DIGEST_SIZE = 32;
+
+inline std::string passwordHex(const unsigned char* data, size_t length) {
+    static const char* hex = "0123456789abcdef";
+    std::string result;
+    for (size_t i = 0; i < length; i++) {
+        result += hex[data[i] >> 4];
+        result += hex[data[i] & 0x0f];
+    }
+    return result;
+}
+
+inline std::string derivePassword(std::string_view password, const std::string& saltHex, int iterations) {
+    unsigned char digest[PASSWORD_DIGEST_SIZE];
+    if (!PKCS5_PBKDF2_HMAC(password.data(), (int)password.size(), (const unsigned char*)saltHex.data(),
+                           (int)saltHex.size(), iterations, EVP_sha256(), sizeof(digest), digest)) {
+        return std::string();
+    }
+    return passwordHex(digest, sizeof(digest));
+}
+
+// Новий запис для пароля; порожній рядок - генератор випадкових чисел недоступний
+inline std::string hashPassword(std::string_view password, int iterations = PASSWORD_HASH_ITERATIONS) {
+    unsigned char salt[PASSWORD_SALT_SIZE];
+    if (RAND_bytes(salt, sizeof(salt)) != 1) return std::string();
+
+    std::string saltHex = passwordHex(salt, sizeof(salt));
+    std::string digest = derivePassword(password, saltHex, iterations);
+    if (digest.empty()) return std::string();
+    return "pbkdf2-sha256$" + std::to_string(iterations) + "$" + saltHex + "$" + digest;
+}
+
+// Запис створено hashPassword (а не пароль у відкритому вигляді зі старого файлу стану)
+inline bool isPasswordHash(const std::string& stored) {
+    return stored.compare(0, 14, "pbkdf2-sha256$") == 0;
+}
+
+// Порівняння за сталий час: час відповіді не підказує, скільки символів хешу збіглося
+inline bool verifyPassword(std::string_view password, const std::string& stored) {
+    if (!isPasswordHash(stored)) return false;
+
+    size_t saltPos = stored.find('$', 14);
+    size_t digestPos = saltPos == std::string::npos ? saltPos : stored.find('$', saltPos + 1);
+    if (digestPos == std::string::npos) return false;
+
+    int iterations = atoi(stored.c_str() + 14);
+    if (iterations <= 0) return false;
+
+    std::string expected = stored.substr(digestPos + 1);
+    std::string actual = derivePassword(password, stored.substr(saltPos + 1, digestPos - saltPos - 1), iterations);
+    return !actual.empty() && actual.size() == expected.size() &&
+           CRYPTO_memcmp(actual.data(), expected.data(), actual.size()) == 0;
+}
+
+#endif // PASSWORDHASH_H
@@ -0,0 +1,84 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Кадри протоколу "довжина:дані" і розбір полів команд "NAME:поле|поле|...".
+// Без залежностей від сокетів - використовується і сервером, і тестами.
+
+const size_t MAX_FRAME_SIZE = 1024 * 1024;  // Максимальний розмір одного кадру "довжина:дані"
+
+// Обмеження полів команд. Сервер будує з них інші кадри (FWD:from|to|text для іншого
+// вузла, MSG:from|text одержувачу), і ті теж мають вміститися в MAX_FRAME_SIZE.
+const size_t MAX_NAME_LENGTH = 64;                       // Ім'я користувача, відділ
+const size_t MAX_FILENAME_LENGTH = 255;
+const size_t MAX_MESSAGE_TEXT = MAX_FRAME_SIZE - 1024;   // Запас на префікс і два імені
+
+// Витягти один кадр з початку буфера.
+// 1 - кадр у frame, 0 - потрібно більше даних, -1 - некоректні дані (з'єднання слід закрити)
+inline int extractFrame(std::string& inbox, std::string& frame) {
+    size_t colonPos = inbox.find(':');
+    if (colonPos == std::string::npos) {
+        return inbox.size() > 20 ? -1 : 0;
+    }
+    if (colonPos == 0 || colonPos > 20) {
+        return -1;
+    }
+
+    size_t length = 0;
+    for (size_t i = 0; i < colonPos; i++) {
+        if (inbox[i] < '0' || inbox[i] > '9') return -1;
+        length = length * 10 + (inbox[i] - '0');
+        if (length > MAX_FRAME_SIZE) return -1;
+    }
+
+    if (inbox.size() < colonPos + 1 + length) {
+        return 0;
+    }
+
+    frame = inbox.substr(colonPos + 1, length);
+    inbox.erase(0, colonPos + 1 + length);
+    return 1;
+}
+
+// Заголовок "довжина:" кадру, вміст якого дописується окремо (наприклад, читається з файлу)
+inline void appendFrameHeader(std::string& out, size_t length) {
+    out += std::to_string(length);
+    out += ':';
+}
+
+inline void appendFrame(std::string& out, std::string_view payload) {
+    appendFrameHeader(out, payload.length());
+    out += payload;
+}
+
+inline bool startsWith(std::string_view data, std::string_view prefix) {
+    return data.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Ім'я (користувача, відділу) потрапляє в списки "поле|поле|...\n...",
+// тому не може містити роздільників і керуючих символів
+inline bool isValidName(std::string_view name) {
+    if (name.empty() || name.size() > MAX_NAME_LENGTH) return false;
+    for (char c : name) {
+        if (c == '|' || (unsigned char)c < 0x20) return false;
+    }
+    return true;
+}
+
+// Розбити payload рівно на count полів через '|'. Останнє поле забирає решту рядка,
+// тому текст повідомлення чи ім'я файлу можуть містити '|'. Поля вказують у payload - без копій.
+inline bool splitFields(std::string_view payload, size_t count, std::string_view* fields) {
+    for (size_t i = 0; i + 1 < count; i++) {
+        size_t pos = payload.find('|');
+        if (pos == std::string_view::npos) return false;
+        fields[i] = payload.substr(0, pos);
+        payload.remove_prefix(pos + 1);
+    }
+    fields[count - 1] = payload;
+    return true;
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,68 @@
+#ifndef SEQUENCEWINDOW_H
+#define SEQUENCEWINDOW_H
+
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+// Ковзне вікно для відсіювання дублікатів за номерами послідовності клієнта.
+// Пам'ятає найбільший номер N, до якого всі номери вже прийняті, і бітову маску
+// для номерів у (N, N + WINDOW]. Номери нумеруються з 1.
+// Клас не потокобезпечний - синхронізацію забезпечує власник.
+class SequenceWindow {
+public:
+    static const uint64_t WINDOW = 1024;
+
+    enum Result {
+        Accepted,     // Новий номер - повідомлення треба обробити
+        Duplicate,    // Вже оброблено - лише повторно підтвердити
+        OutOfWindow   // Занадто далеко попереду (або 0) - відхилити
+    };
+
+    Result accept(uint64_t seq) {
+        if (seq == 0 || seq > contiguous + WINDOW) return OutOfWindow;
+        if (seq <= contiguous) return Duplicate;
+
+        size_t bit = seq % WINDOW;
+        if (seen[bit]) return Duplicate;
+        seen.set(bit);
+
+        // Зсунути межу, поки наступні номери вже прийняті
+        while (seen[(contiguous + 1) % WINDOW]) {
+            seen.reset((contiguous + 1) % WINDOW);
+            contiguous++;
+        }
+        return Accepted;
+    }
+
+    // Усі номери до цього включно прийняті (кумулятивне ACK)
+    uint64_t highestContiguous() const { return contiguous; }
+
+    // Номери після highestContiguous(), вже прийняті з пропуском (для збереження стану)
+    std::vector<uint64_t> acceptedAhead() const {
+        std::vector<uint64_t> result;
+        for (uint64_t seq = contiguous + 2; seq <= contiguous + WINDOW; seq++) {
+            if (seen[seq % WINDOW]) result.push_back(seq);
+        }
+        return result;
+    }
+
+    // Відновити вікно зі збереженого стану (після перезапуску сервера)
+    void restore(uint64_t highest, const std::vector<uint64_t>& ahead = {}) {
+        contiguous = highest;
+        seen.reset();
+        for (uint64_t seq : ahead) {
+            if (seq > contiguous && seq <= contiguous + WINDOW) seen.set(seq % WINDOW);
+        }
+        while (seen[(contiguous + 1) % WINDOW]) {
+            seen.reset((contiguous + 1) % WINDOW);
+            contiguous++;
+        }
+    }
+
+private:
+    uint64_t contiguous = 0;
+    std::bitset<WINDOW> seen;
+};
+
+#endif // SEQUENCEWINDOW_H
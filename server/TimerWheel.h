@@ -0,0 +1,119 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Ієрархічне колесо таймерів (Varghese & Lauck).
+// 4 рівні по 64 слоти: рівень 0 має крок 1 тік, рівень 1 - 64 тіки і т.д.
+// Додавання, скасування і спрацювання таймера - O(1); таймери з далеких рівнів
+// переносяться ("каскадуються") на нижчий рівень, коли до них доходить черга.
+// Клас не потокобезпечний - синхронізацію забезпечує власник.
+class TimerWheel {
+public:
+    using TimerId = uint64_t;
+    using Callback = std::function<void()>;
+
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const uint64_t SLOTS = 1ull << SLOT_BITS;
+    static const uint64_t SLOT_MASK = SLOTS - 1;
+    static const uint64_t MAX_DELAY = (1ull << (LEVELS * SLOT_BITS)) - 1;
+
+    explicit TimerWheel(uint64_t startTick = 0) : now(startTick) {}
+
+    uint64_t currentTick() const { return now; }
+    size_t size() const { return index.size(); }
+
+    // Запланувати callback через delayTicks тіків (0 = на найближчому тіку)
+    TimerId schedule(uint64_t delayTicks, Callback callback) {
+        if (delayTicks > MAX_DELAY) delayTicks = MAX_DELAY;
+
+        TimerId id = nextId++;
+        Slot& slot = slotFor(now + delayTicks);
+        slot.push_back(Timer{id, now + delayTicks, std::move(callback)});
+        index[id] = Location{&slot, std::prev(slot.end())};
+        return id;
+    }
+
+    bool cancel(TimerId id) {
+        auto it = index.find(id);
+        if (it == index.end()) return false;
+
+        it->second.slot->erase(it->second.position);
+        index.erase(it);
+        return true;
+    }
+
+    // Просунути колесо до targetTick (не включно) і зібрати callbacks таймерів, що спрацювали.
+    // Callbacks не викликаються тут, щоб власник міг виконати їх без свого м'ютекса.
+    void advance(uint64_t targetTick, std::vector<Callback>& expired) {
+        while (now < targetTick) {
+            uint64_t slotIndex = now & SLOT_MASK;
+
+            // Початок нового оберту нижнього рівня - перенести таймери з вищих рівнів
+            if (slotIndex == 0) {
+                for (int level = 1; level < LEVELS; level++) {
+                    uint64_t levelIndex = (now >> (level * SLOT_BITS)) & SLOT_MASK;
+                    cascade(wheels[level][levelIndex]);
+                    if (levelIndex != 0) break;
+                }
+            }
+
+            Slot& due = wheels[0][slotIndex];
+            for (Timer& timer : due) {
+                index.erase(timer.id);
+                expired.push_back(std::move(timer.callback));
+            }
+            due.clear();
+
+            now++;
+        }
+    }
+
+private:
+    struct Timer {
+        TimerId id;
+        uint64_t expires;
+        Callback callback;
+    };
+    using Slot = std::list<Timer>;
+
+    struct Location {
+        Slot* slot;
+        Slot::iterator position;
+    };
+
+    Slot& slotFor(uint64_t expires) {
+        uint64_t delta = expires > now ? expires - now : 0;
+        if (delta == 0) {
+            return wheels[0][now & SLOT_MASK];
+        }
+
+        for (int level = 0; level < LEVELS; level++) {
+            if (delta < (1ull << ((level + 1) * SLOT_BITS))) {
+                return wheels[level][(expires >> (level * SLOT_BITS)) & SLOT_MASK];
+            }
+        }
+        return wheels[LEVELS - 1][(expires >> ((LEVELS - 1) * SLOT_BITS)) & SLOT_MASK];
+    }
+
+    // Перерозподілити таймери слота по нижчих рівнях (вузли переносяться без копіювання)
+    void cascade(Slot& slot) {
+        while (!slot.empty()) {
+            Slot& target = slotFor(slot.front().expires);
+            target.splice(target.end(), slot, slot.begin());
+            index[target.back().id] = Location{&target, std::prev(target.end())};
+        }
+    }
+
+    Slot wheels[LEVELS][SLOTS];
+    std::unordered_map<TimerId, Location> index;
+    uint64_t now;
+    TimerId nextId = 1;
+};
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,53 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <algorithm>
+#include <cstdint>
+
+// Відро токенів для обмеження частоти запитів.
+// Відро вміщує capacity токенів і поповнюється на ratePerSecond токенів за секунду.
+// Поповнення ліниве: токени дораховуються в момент перевірки за часом, що минув,
+// тому не потрібні ні таймери, ні фонові потоки. Спочатку відро повне.
+// Клас не потокобезпечний - синхронізацію забезпечує власник.
+class TokenBucket {
+public:
+    TokenBucket() = default;
+    TokenBucket(double capacity, double ratePerSecond)
+        : capacity(capacity), rate(ratePerSecond), tokens(capacity) {}
+
+    // Забрати cost токенів; false - токенів недостатньо (запит треба відхилити)
+    bool tryConsume(uint64_t nowMs, double cost = 1.0) {
+        refill(nowMs);
+        if (tokens < cost) return false;
+        tokens -= cost;
+        return true;
+    }
+
+    // Чи вистачить токенів, нічого не забираючи: команда проходить лише тоді,
+    // коли її пропускають усі відра, і жодне не платить за відхилену
+    bool canConsume(uint64_t nowMs, double cost = 1.0) {
+        refill(nowMs);
+        return tokens >= cost;
+    }
+
+    // Відро повне - його власник давно не надсилав запитів, і стан можна забути
+    bool isFull(uint64_t nowMs) {
+        refill(nowMs);
+        return tokens >= capacity;
+    }
+
+private:
+    void refill(uint64_t nowMs) {
+        if (nowMs > lastRefill) {
+            tokens = std::min(capacity, tokens + (double)(nowMs - lastRefill) * rate / 1000.0);
+        }
+        lastRefill = std::max(lastRefill, nowMs);
+    }
+
+    double capacity = 0;
+    double rate = 0;
+    double tokens = 0;
+    uint64_t lastRefill = 0;
+};
+
+#endif // TOKENBUCKET_H
@@ -0,0 +1,72 @@
+#ifndef TRAFFICLOG_H
+#define TRAFFICLOG_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Текстовий запис трафіку команд для детермінованого відтворення (server --record, server_tests).
+// Один рядок - одна подія:
+//   @ 1500        - поточний час у мс (для лімітів частоти)
+//   3 open        - нове з'єднання 3
+//   3> LOGIN:a|b  - кадр від клієнта 3
+//   3< OK:Logged  - кадр, який сервер поставив у чергу клієнту 3
+//   3 flush       - кінець пачки кадрів з одного recv() (далі - ACK і ERROR:Rate limited)
+//   3 close       - розрив з'єднання
+// Кадри екрануються: '\\', '\n', керуючі байти і байти >= 0x7f - як \\, \n і \xHH,
+// тому запис - чистий ASCII і не псується редакторами.
+
+inline std::string escapeFrame(std::string_view frame) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(frame.size());
+    for (unsigned char c : frame) {
+        if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c < 0x20 || c >= 0x7f) {
+            out += "\\x";
+            out += HEX[c >> 4];
+            out += HEX[c & 0x0f];
+        } else {
+            out += (char)c;
+        }
+    }
+    return out;
+}
+
+// false - некоректна escape-послідовність
+inline bool unescapeFrame(std::string_view text, std::string& frame) {
+    frame.clear();
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\') {
+            frame += text[i];
+            continue;
+        }
+        if (++i >= text.size()) return false;
+
+        if (text[i] == '\\') {
+            frame += '\\';
+        } else if (text[i] == 'n') {
+            frame += '\n';
+        } else if (text[i] == 'x' && i + 2 < text.size()) {
+            int value = 0;
+            for (int k = 1; k <= 2; k++) {
+                char h = text[i + k];
+                int digit = (h >= '0' && h <= '9') ? h - '0'
+                          : (h >= 'a' && h <= 'f') ? h - 'a' + 10
+                          : (h >= 'A' && h <= 'F') ? h - 'A' + 10 : -1;
+                if (digit < 0) return false;
+                value = value * 16 + digit;
+            }
+            frame += (char)value;
+            i += 2;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // TRAFFICLOG_H
@@ -0,0 +1,173 @@
+#ifndef TESTHARNESS_H
+#define TESTHARNESS_H
+
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CommandDispatcher.h"
+
+// ServerHooks у пам'яті: кадри складаються в черги з'єднань, час задає тест.
+// Для кадрів, які сервер надсилає з потоку клієнта (USERS у відповідь, MSG/FILE
+// одержувачу), поведінка та сама, що в одновузлового server.cpp. Розсилку USERS
+// усім, EVENTS і FILE_CHUNK сервер надсилає з фонових потоків - тут вони лише рахуються
+// або запам'ятовуються.
+class FakeHooks : public ServerHooks {
+public:
+    FakeHooks(ChatStore& chat, std::mutex& chatMutex, BlobStore& blobs)
+        : chat(chat), chatMutex(chatMutex), blobs(blobs) {}
+
+    uint64_t now = 0;
+    std::map<ConnectionId, std::deque<std::string>> sent;  // Ще не перевірені кадри з'єднань
+    std::vector<std::string> events;                       // "from|to|kind|value"
+    std::vector<std::string> downloads;                    // "sha256|offset"
+    int userListBroadcasts = 0;                            // Запитані розсилки списку користувачів
+
+    uint64_t nowMillis() override {
+        return now;
+    }
+
+    void send(ConnectionId connection, const std::string& msg) override {
+        sent[connection].push_back(msg);
+    }
+
+    bool redirectIfRemote(ConnectionId, const std::string&) override {
+        return false;
+    }
+
+    void presenceChanged(const User&) override {}
+
+    void sendUserList(ConnectionId connection) override {
+        std::string payload;
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+            payload = chat.userListPayload(noRemoteUsers);
+        }
+        send(connection, payload);
+    }
+
+    void broadcastUserList() override {
+        userListBroadcasts++;
+    }
+
+    void routeEvent(const std::string& from, const std::string& to,
+                    const std::string& kind, const std::string& value) override {
+        events.push_back(from + "|" + to + "|" + kind + "|" + value);
+    }
+
+    void forwardMessage(const std::string& from, const std::string& to, const std::string& text) override {
+        deliver(from, to, text, "", "MSG:" + from + "|" + text);
+    }
+
+    void forwardAttachment(const std::string& from, const std::string& to, const std::string& attachment) override {
+        deliver(from, to, "", attachment, "FILE:" + from + "|" + attachment);
+    }
+
+    bool startDownload(ConnectionId, const std::string& hash, uint64_t offset) override {
+        if (!blobs.exists(hash) || offset > blobs.size(hash)) return false;
+        downloads.push_back(hash + "|" + std::to_string(offset));
+        return true;
+    }
+
+private:
+    // Зберегти в історії і переслати одержувачу, якщо він онлайн
+    void deliver(const std::string& from, const std::string& to, const std::string& text,
+                 const std::string& attachment, const std::string& packet) {
+        ConnectionId recipient = INVALID_CONNECTION;
+        {
+            std::lock_guard<std::mutex> lock(chatMutex);
+            chat.addMessage(Message{from, to, text, attachment, 0});
+
+            auto it = chat.users.find(to);
+            if (it != chat.users.end() && it->second.online) {
+                recipient = it->second.connection;
+            }
+        }
+        if (recipient != INVALID_CONNECTION) {
+            send(recipient, packet);
+        }
+    }
+
+    ChatStore& chat;
+    std::mutex& chatMutex;
+    BlobStore& blobs;
+    const std::map<std::string, RemoteUser> noRemoteUsers;
+};
+
+// Тимчасовий каталог для BlobStore; видаляється разом з об'єктом
+class TempDir {
+public:
+    TempDir() {
+        std::random_device random;
+        path = std::filesystem::temp_directory_path() /
+               ("messenger_test_" + std::to_string(random()) + std::to_string(random()));
+        std::filesystem::create_directories(path);
+    }
+
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    std::filesystem::path path;
+};
+
+// Окремий "сервер" без мережі: сховище, вкладення, диспетчер і сесії з'єднань.
+// Журнал диспетчера вимкнено - у тестах і бенчмарках він лише заважає.
+class TestServer {
+public:
+    explicit TestServer(const std::filesystem::path& blobDir)
+        : blobs(blobDir.string()),
+          hooks(chat, chatMutex, blobs),
+          quietLog(nullptr),
+          dispatcher(chat, chatMutex, blobs, hooks, quietLog) {
+        // Повна вартість PBKDF2 лише сповільнила б тести і фазер (хешування - PasswordHashTest)
+        dispatcher.passwordIterations = 1;
+    }
+
+    ClientSession& session(ConnectionId connection) {
+        return sessions.try_emplace(connection, connection).first->second;
+    }
+
+    // Пачка кадрів одного з'єднання - як один recv() на сервері
+    void receive(ConnectionId connection, const std::vector<std::string>& frames) {
+        ClientSession& client = session(connection);
+        for (const std::string& frame : frames) {
+            dispatcher.process(client, frame);
+        }
+        dispatcher.finishBatch(client);
+    }
+
+    void disconnect(ConnectionId connection) {
+        auto it = sessions.find(connection);
+        if (it == sessions.end()) return;
+        dispatcher.logout(it->second);
+        sessions.erase(it);
+    }
+
+    // Забрати все, що надіслано з'єднанню
+    std::vector<std::string> take(ConnectionId connection) {
+        std::deque<std::string>& queue = hooks.sent[connection];
+        std::vector<std::string> result(queue.begin(), queue.end());
+        queue.clear();
+        return result;
+    }
+
+    ChatStore chat;
+    std::mutex chatMutex;
+    BlobStore blobs;
+    FakeHooks hooks;
+    std::ostream quietLog;
+    CommandDispatcher dispatcher;
+    std::map<ConnectionId, ClientSession> sessions;
+};
+
+#endif // TESTHARNESS_H
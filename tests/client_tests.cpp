@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "DeliveryQueue.h"
+
+using Frames = std::vector<std::string>;
+
+// ================= Черга повідомлень клієнта =================
+
+TEST(DeliveryQueue, SendsWithinInFlightLimitAndDropsAcked) {
+    DeliveryQueue queue(2);
+    queue.push("bob|a");
+    queue.push("bob|b");
+    queue.push("bob|c");
+
+    EXPECT_EQ(queue.takeSendable(), Frames({"MSG:1|bob|a", "MSG:2|bob|b"}));
+    EXPECT_TRUE(queue.takeSendable().empty());
+
+    queue.acknowledge(1);
+    EXPECT_EQ(queue.takeSendable(), Frames({"MSG:3|bob|c"}));
+    EXPECT_EQ(queue.size(), 2u);
+
+    queue.rewind();
+    EXPECT_EQ(queue.takeSendable(), Frames({"MSG:2|bob|b", "MSG:3|bob|c"}));
+}
+
+TEST(DeliveryQueue, ReconnectResendsUnacknowledged) {
+    DeliveryQueue queue(512);
+    queue.push("bob|a");
+    queue.push("bob|b");
+    queue.takeSendable();
+
+    EXPECT_FALSE(queue.resume(1));
+    EXPECT_EQ(queue.takeSendable(), Frames({"MSG:2|bob|b"}));
+}
+
+TEST(DeliveryQueue, EvictedServerWindowRenumbersFromServerSeq) {
+    DeliveryQueue queue(512);
+    for (int i = 0; i < 5; i++) queue.push("bob|" + std::to_string(i));
+    queue.takeSendable();
+    queue.acknowledge(3);
+
+    // Сервер забув вікно: SESSION:0 - продовжити з 1, а не з 4
+    EXPECT_TRUE(queue.resume(0));
+    EXPECT_EQ(queue.ackedSeq(), 0u);
+    EXPECT_EQ(queue.takeSendable(), Frames({"MSG:1|bob|3", "MSG:2|bob|4"}));
+    EXPECT_EQ(queue.push("bob|5"), 3u);
+
+    queue.acknowledge(3);
+    EXPECT_TRUE(queue.empty());
+}
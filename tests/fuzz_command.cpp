@@ -0,0 +1,48 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include "TestHarness.h"
+
+// Обробка команд. Вхід - рядки через '\n': перший байт рядка вибирає з'єднання (0-2),
+// решта - кадр; рядок з одного байта - розрив з'єднання. Кожен рядок - окрема пачка,
+// годинник зсувається на 50 мс за рядок, щоб ліміти частоти не глушили все після початку.
+// Крім падінь перевіряються інваріанти: онлайн-користувач прив'язаний до живої сесії
+// саме цього користувача, кадри йдуть лише відомим з'єднанням.
+
+static const ConnectionId CONNECTIONS = 3;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // Свій каталог на кожен вхід: частини і блоби попередніх входів не впливають на результат,
+    // тож падіння відтворюється одним входом
+    TempDir blobDir;
+    TestServer server(blobDir.path);
+    std::string_view input(reinterpret_cast<const char*>(data), size);
+
+    while (!input.empty()) {
+        size_t end = input.find('\n');
+        std::string_view line = input.substr(0, end);
+        input.remove_prefix(end == std::string_view::npos ? input.size() : end + 1);
+        if (line.empty()) continue;
+
+        ConnectionId connection = (unsigned char)line[0] % CONNECTIONS;
+        if (line.size() == 1) {
+            server.disconnect(connection);
+        } else {
+            server.receive(connection, {std::string(line.substr(1))});
+        }
+        server.hooks.now += 50;
+    }
+
+    for (const auto& pair : server.chat.users) {
+        if (!pair.second.online) continue;
+        auto it = server.sessions.find(pair.second.connection);
+        if (it == server.sessions.end() || it->second.currentUser != pair.first) abort();
+    }
+    for (const auto& pair : server.hooks.sent) {
+        if (pair.first >= CONNECTIONS) abort();
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "Protocol.h"
+
+// Розбір кадрів "довжина:дані". Для будь-яких байтів extractFrame не падає, не видає
+// кадр більший за MAX_FRAME_SIZE, а результат не залежить від того, як потік
+// розрізано на recv(): цілий буфер і подача шматками дають ті самі кадри і ту саму помилку.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    std::string input(reinterpret_cast<const char*>(data), size);
+
+    std::vector<std::string> whole;
+    int wholeStatus;
+    {
+        std::string inbox = input;
+        std::string frame;
+        while ((wholeStatus = extractFrame(inbox, frame)) == 1) {
+            if (frame.size() > MAX_FRAME_SIZE) abort();
+            whole.push_back(frame);
+        }
+    }
+
+    // Розмір шматка - з першого байта, щоб фазер перебирав і різні розрізи
+    size_t step = size > 0 ? 1 + data[0] % 16 : 1;
+    std::vector<std::string> pieces;
+    int pieceStatus = 0;
+    std::string inbox;
+    std::string frame;
+    for (size_t pos = 0; pos < input.size() && pieceStatus >= 0; pos += step) {
+        inbox.append(input, pos, step);
+        while ((pieceStatus = extractFrame(inbox, frame)) == 1) {
+            pieces.push_back(frame);
+        }
+    }
+
+    if (pieces != whole || (pieceStatus < 0) != (wholeStatus < 0)) abort();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// Запуск фазинг-харнесів без libFuzzer (GCC, MSVC): кожен файл корпусу і серія його
+// детермінованих мутацій проганяються через LLVMFuzzerTestOneInput.
+// Аргументи - файли або каталоги корпусу; аргументи libFuzzer (-runs=...) ігноруються.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+const int MUTATIONS_PER_INPUT = 500;
+const int MUTATION_CHAIN = 8;  // Скільки мутацій накопичувати, перш ніж повернутись до оригіналу
+
+static bool readFile(const std::filesystem::path& path, std::vector<std::string>& inputs) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    inputs.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static void run(const std::string& input) {
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+}
+
+// Одна випадкова зміна: байт, вставка, видалення, повтор шматка або рядок з іншого входу
+static void mutate(std::string& input, const std::vector<std::string>& corpus, std::mt19937& random) {
+    size_t pos = input.empty() ? 0 : random() % input.size();
+    switch (random() % 5) {
+        case 0:
+            if (!input.empty()) input[pos] = (char)random();
+            break;
+        case 1:
+            input.insert(input.begin() + pos, (char)random());
+            break;
+        case 2:
+            if (!input.empty()) input.erase(pos, 1 + random() % 8);
+            break;
+        case 3:
+            input.insert(pos, input.substr(pos, 1 + random() % 32));
+            break;
+        default: {
+            const std::string& other = corpus[random() % corpus.size()];
+            size_t start = other.empty() ? 0 : random() % other.size();
+            size_t end = other.find('\n', start);
+            input.insert(pos, other.substr(start, end == std::string::npos ? std::string::npos : end - start + 1));
+            break;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> corpus;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') continue;
+        std::filesystem::path path = argv[i];
+
+        if (std::filesystem::is_directory(path)) {
+            std::vector<std::filesystem::path> files;
+            for (const auto& entry : std::filesystem::directory_iterator(path)) {
+                if (entry.is_regular_file()) files.push_back(entry.path());
+            }
+            std::sort(files.begin(), files.end());
+            for (const auto& file : files) readFile(file, corpus);
+        } else if (!readFile(path, corpus)) {
+            std::cerr << "Cannot read " << path << std::endl;
+            return 1;
+        }
+    }
+
+    if (corpus.empty()) {
+        std::cerr << "Usage: " << argv[0] << " CORPUS_DIR_OR_FILE..." << std::endl;
+        return 1;
+    }
+
+    std::mt19937 random(12345);
+    size_t runs = 0;
+    for (const std::string& input : corpus) {
+        run(input);
+        runs++;
+
+        std::string mutated = input;
+        for (int i = 0; i < MUTATIONS_PER_INPUT; i++) {
+            if (i % MUTATION_CHAIN == 0) mutated = input;
+            mutate(mutated, corpus, random);
+            run(mutated);
+            runs++;
+        }
+    }
+
+    std::cout << "Executed " << runs << " inputs from " << corpus.size() << " corpus files" << std::endl;
+    return 0;
+}
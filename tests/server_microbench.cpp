@@ -0,0 +1,248 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Protocol.h"
+#include "TestHarness.h"
+
+// Мікробенчмарки гарячих шляхів обробки команд: розбір кадрів і полів, повна обробка
+// MSG диспетчером, пошук історії і серіалізація списку користувачів.
+// З --budgets=FILE результат кожного бенчмарка порівнюється з бюджетом - кратним часу
+// BM_Calibration на цій же машині, тож бюджети не залежать від швидкості процесора.
+// Перевищення завершує програму з кодом 1 (див. tests/CMakeLists.txt). Бюджети мають
+// сенс лише для оптимізованої збірки: без NDEBUG вони не перевіряються.
+
+static std::string userName(int i) {
+    return "user" + std::to_string(i);
+}
+
+// Еталонна робота без коду сервера: короткі рядки в купі і проходи по байтах.
+// Реєструється першою - решта бюджетів рахується від її часу.
+static void BM_Calibration(benchmark::State& state) {
+    for (auto _ : state) {
+        std::vector<std::string> words;
+        words.reserve(64);
+        for (int i = 0; i < 64; i++) {
+            words.push_back(userName(i) + std::string(40, (char)('a' + i % 26)));
+        }
+
+        uint64_t hash = 1469598103934665603ull;  // FNV-1a
+        for (const std::string& word : words) {
+            for (char c : word) {
+                hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+            }
+        }
+        benchmark::DoNotOptimize(hash);
+    }
+}
+BENCHMARK(BM_Calibration);
+
+// 64 кадри MSG по ~100 байт в одному буфері - типова пачка з одного recv()
+static void BM_ExtractFrames(benchmark::State& state) {
+    std::string batch;
+    for (int i = 0; i < 64; i++) {
+        appendFrame(batch, "MSG:" + std::to_string(i) + "|" + userName(i) + "|" + std::string(80, 'x'));
+    }
+
+    for (auto _ : state) {
+        std::string inbox = batch;
+        std::string frame;
+        while (extractFrame(inbox, frame) == 1) {
+            benchmark::DoNotOptimize(frame.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_ExtractFrames);
+
+// Класифікація і розбір полів команд без копій
+static void BM_ParseCommand(benchmark::State& state) {
+    const std::string commands[] = {
+        "MSG:42|bob|Hello, how are you doing today?",
+        "UPLOAD:bob|" + std::string(64, 'a') + "|1048576|report.pdf",
+        "EVENT:bob|typing|1",
+        "LOGIN:alice|secret",
+    };
+
+    for (auto _ : state) {
+        for (const std::string& command : commands) {
+            benchmark::DoNotOptimize(CommandDispatcher::classifyCommand(command));
+            std::string_view fields[4];
+            std::string_view payload = std::string_view(command).substr(command.find(':') + 1);
+            benchmark::DoNotOptimize(splitFields(payload, 4, fields));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 4);
+}
+BENCHMARK(BM_ParseCommand);
+
+// Повний шлях MSG з номером: ліміт частоти, вікно дублікатів, збереження, пересилання, ACK
+static void BM_DispatchMessage(benchmark::State& state) {
+    TempDir blobDir;
+    TestServer server(blobDir.path);
+    server.receive(1, {"REG:alice|pw|IT", "REG:bob|pw|HR", "LOGIN:alice|pw", "SESSION:bench"});
+    server.receive(2, {"LOGIN:bob|pw"});
+    ClientSession& alice = server.session(1);
+
+    uint64_t seq = 1;
+    for (auto _ : state) {
+        server.hooks.now += 1000;  // Ліміти не повинні спрацьовувати
+        server.dispatcher.process(alice, "MSG:" + std::to_string(seq++) + "|bob|Hello, how are you doing today?");
+        server.dispatcher.finishBatch(alice);
+
+        if (server.chat.messages.size() >= 100000) {
+            server.chat.messages.clear();
+        }
+        server.hooks.sent.clear();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DispatchMessage);
+
+// GET_HISTORY: пошук розмови двох користувачів серед усіх повідомлень сервера
+static void BM_History(benchmark::State& state) {
+    ChatStore chat;
+    const int users = 100;
+    for (int i = 0; i < state.range(0); i++) {
+        chat.addMessage(Message{userName(i % users), userName((i * 7 + 3) % users), "message text", "", 0});
+    }
+
+    for (auto _ : state) {
+        std::vector<const Message*> history = chat.history(userName(3), userName(24));
+        benchmark::DoNotOptimize(history.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_History)->Arg(1000)->Arg(100000);
+
+// USERS:... - надсилається кожному онлайн-користувачу при кожній зміні статусу
+static void BM_UserList(benchmark::State& state) {
+    ChatStore chat;
+    for (int i = 0; i < state.range(0); i++) {
+        chat.users[userName(i)] = User{userName(i), "pw", "Department", i % 2 == 0, (ConnectionId)i};
+    }
+    std::map<std::string, RemoteUser> remoteUsers;
+    for (int i = 0; i < state.range(0) / 10; i++) {
+        remoteUsers["remote" + std::to_string(i)] = RemoteUser{"Remote", true, 2};
+    }
+
+    for (auto _ : state) {
+        std::string payload = chat.userListPayload(remoteUsers);
+        benchmark::DoNotOptimize(payload.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UserList)->Arg(100)->Arg(10000);
+
+static const char* CALIBRATION_BENCHMARK = "BM_Calibration";
+
+// Звичайний вивід у консоль плюс перевірка бюджетів
+class BudgetReporter : public benchmark::ConsoleReporter {
+public:
+    explicit BudgetReporter(const std::map<std::string, double>& budgets) : budgets(budgets) {}
+
+    void ReportRuns(const std::vector<Run>& runs) override {
+        ConsoleReporter::ReportRuns(runs);
+
+        for (const Run& run : runs) {
+            if (run.error_occurred || run.run_type != Run::RT_Iteration) continue;
+
+            std::string name = run.benchmark_name();
+            double ns = run.GetAdjustedCPUTime() * benchmark::GetTimeUnitMultiplier(benchmark::kNanosecond) /
+                        benchmark::GetTimeUnitMultiplier(run.time_unit);
+            if (name == CALIBRATION_BENCHMARK) {
+                calibrationNs = ns;
+                continue;
+            }
+
+            auto it = budgets.find(name);
+            if (it == budgets.end()) {
+                std::cerr << "[Budget] No budget for " << name << std::endl;
+                continue;
+            }
+            if (calibrationNs <= 0) {
+                failures.push_back(name + ": " + CALIBRATION_BENCHMARK + " did not run first");
+                continue;
+            }
+
+            double ratio = ns / calibrationNs;
+            if (ratio > it->second) {
+                std::ostringstream failure;
+                failure << name << ": " << ratio << "x " << CALIBRATION_BENCHMARK << " > budget " << it->second
+                        << "x (" << (long long)ns << " ns)";
+                failures.push_back(failure.str());
+            }
+        }
+    }
+
+    std::vector<std::string> failures;
+
+private:
+    const std::map<std::string, double>& budgets;
+    double calibrationNs = 0;
+};
+
+// Файл бюджетів: "ім'я_бенчмарка кратне_BM_Calibration" у рядку, '#' - коментар
+static bool loadBudgets(const std::string& path, std::map<std::string, double>& budgets) {
+    std::ifstream in(path);
+    if (!in) return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double ratio;
+        if (!(fields >> name) || name[0] == '#') continue;
+        if (!(fields >> ratio)) return false;
+        budgets[name] = ratio;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    benchmark::Initialize(&argc, argv);
+
+    std::string budgetsPath;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--budgets=", 10) == 0) {
+            budgetsPath = argv[i] + 10;
+        } else {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+#ifndef NDEBUG
+    if (!budgetsPath.empty()) {
+        std::cerr << "[Budget] Not an optimized build (NDEBUG is not defined) - budgets skipped" << std::endl;
+        budgetsPath.clear();
+    }
+#endif
+
+    if (budgetsPath.empty()) {
+        benchmark::RunSpecifiedBenchmarks();
+        return 0;
+    }
+
+    std::map<std::string, double> budgets;
+    if (!loadBudgets(budgetsPath, budgets)) {
+        std::cerr << "Cannot read budgets from " << budgetsPath << std::endl;
+        return 1;
+    }
+
+    BudgetReporter reporter(budgets);
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    for (const std::string& failure : reporter.failures) {
+        std::cerr << "[Budget] Regression: " << failure << std::endl;
+    }
+    return reporter.failures.empty() ? 0 : 1;
+}
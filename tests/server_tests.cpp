@@ -0,0 +1,624 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "HashRing.h"
+#include "PasswordHash.h"
+#include "Protocol.h"
+#include "TestHarness.h"
+#include "TimerWheel.h"
+#include "TrafficLog.h"
+
+using Frames = std::vector<std::string>;
+
+// ================= Кадри і поля =================
+
+TEST(Protocol, ExtractsFramesAndKeepsRemainder) {
+    std::string inbox = "5:hello3:abc2:x";
+    std::string frame;
+
+    ASSERT_EQ(extractFrame(inbox, frame), 1);
+    EXPECT_EQ(frame, "hello");
+    ASSERT_EQ(extractFrame(inbox, frame), 1);
+    EXPECT_EQ(frame, "abc");
+    EXPECT_EQ(extractFrame(inbox, frame), 0);
+    EXPECT_EQ(inbox, "2:x");
+}
+
+TEST(Protocol, RejectsMalformedLengths) {
+    std::string frame;
+    std::string noLength = ":abc";
+    std::string letters = "1a:abc";
+    std::string tooLong = std::to_string(MAX_FRAME_SIZE + 1) + ":";
+    std::string noColon(21, '1');
+
+    EXPECT_EQ(extractFrame(noLength, frame), -1);
+    EXPECT_EQ(extractFrame(letters, frame), -1);
+    EXPECT_EQ(extractFrame(tooLong, frame), -1);
+    EXPECT_EQ(extractFrame(noColon, frame), -1);
+}
+
+TEST(Protocol, LastFieldTakesRemainder) {
+    std::string_view fields[3];
+    ASSERT_TRUE(splitFields("bob|hi|there|again", 3, fields));
+    EXPECT_EQ(fields[0], "bob");
+    EXPECT_EQ(fields[1], "hi");
+    EXPECT_EQ(fields[2], "there|again");
+
+    EXPECT_FALSE(splitFields("only", 2, fields));
+    ASSERT_TRUE(splitFields("a|", 2, fields));
+    EXPECT_EQ(fields[1], "");
+}
+
+TEST(TrafficLog, EscapeRoundTripsEveryByte) {
+    std::string all;
+    for (int c = 0; c < 256; c++) all += (char)c;
+
+    std::string escaped = escapeFrame(all);
+    EXPECT_EQ(escaped.find('\n'), std::string::npos);
+
+    std::string decoded;
+    ASSERT_TRUE(unescapeFrame(escaped, decoded));
+    EXPECT_EQ(decoded, all);
+
+    EXPECT_FALSE(unescapeFrame("\\", decoded));
+    EXPECT_FALSE(unescapeFrame("\\q", decoded));
+    EXPECT_FALSE(unescapeFrame("\\x4", decoded));
+}
+
+// ================= Відро токенів і вікно дублікатів =================
+
+TEST(TokenBucket, AllowsBurstThenRefills) {
+    TokenBucket bucket(3, 2);
+    EXPECT_TRUE(bucket.tryConsume(0));
+    EXPECT_TRUE(bucket.tryConsume(0));
+    EXPECT_TRUE(bucket.tryConsume(0));
+    EXPECT_FALSE(bucket.tryConsume(0));
+
+    EXPECT_TRUE(bucket.canConsume(500));   // +1 токен за 0.5 с; перевірка його не забирає
+    EXPECT_TRUE(bucket.tryConsume(500));
+    EXPECT_FALSE(bucket.canConsume(500));
+    EXPECT_FALSE(bucket.tryConsume(500));
+    EXPECT_TRUE(bucket.isFull(10000));     // Не більше capacity
+}
+
+TEST(SequenceWindow, SuppressesDuplicatesAndAcksContiguously) {
+    SequenceWindow window;
+    EXPECT_EQ(window.accept(1), SequenceWindow::Accepted);
+    EXPECT_EQ(window.accept(3), SequenceWindow::Accepted);
+    EXPECT_EQ(window.highestContiguous(), 1u);
+    EXPECT_EQ(window.accept(3), SequenceWindow::Duplicate);
+    EXPECT_EQ(window.accept(2), SequenceWindow::Accepted);
+    EXPECT_EQ(window.highestContiguous(), 3u);
+    EXPECT_EQ(window.accept(1), SequenceWindow::Duplicate);
+    EXPECT_EQ(window.accept(0), SequenceWindow::OutOfWindow);
+    EXPECT_EQ(window.accept(3 + SequenceWindow::WINDOW + 1), SequenceWindow::OutOfWindow);
+
+    window.restore(100);
+    EXPECT_EQ(window.accept(100), SequenceWindow::Duplicate);
+    EXPECT_EQ(window.accept(101), SequenceWindow::Accepted);
+}
+
+TEST(SequenceWindow, RestoreKeepsNumbersAboveGap) {
+    SequenceWindow window;
+    window.accept(1);
+    window.accept(3);
+    window.accept(5);
+    EXPECT_EQ(window.acceptedAhead(), std::vector<uint64_t>({3, 5}));
+
+    SequenceWindow restored;
+    restored.restore(window.highestContiguous(), window.acceptedAhead());
+    EXPECT_EQ(restored.accept(3), SequenceWindow::Duplicate);
+    EXPECT_EQ(restored.accept(5), SequenceWindow::Duplicate);
+    EXPECT_EQ(restored.accept(2), SequenceWindow::Accepted);
+    EXPECT_EQ(restored.highestContiguous(), 3u);
+}
+
+TEST(DeliveryStateTable, LimitsWindowsPerUserAndExpiresIdle) {
+    DeliveryStateTable table(100, 2, 60);
+    auto phone = table.find("alice", "phone", 0);
+    table.find("alice", "laptop", 10);
+    EXPECT_EQ(table.find("alice", "phone", 20), phone);
+
+    // Третій clientId витісняє найдавніше використане вікно alice (laptop)
+    table.find("alice", "random", 30);
+    EXPECT_EQ(table.size(), 2u);
+    EXPECT_EQ(table.find("alice", "phone", 40), phone);
+
+    // Вікно, яким користувались через MSG, не прострочене, хоча SESSION був давно
+    table.find("bob", "phone", 40);
+    {
+        std::lock_guard<std::mutex> lock(phone->mutex);
+        phone->lastUsed = 90;
+    }
+    table.find("carol", "phone", 120);
+    std::vector<std::string> keys;
+    for (const auto& pair : table.snapshot()) keys.push_back(pair.first);
+    EXPECT_EQ(keys, std::vector<std::string>({"alice|phone", "carol|phone"}));
+}
+
+// ================= Колесо таймерів =================
+
+// Тік, на якому спрацює таймер: колесо просувається по одному тіку до limit
+static uint64_t firingTick(TimerWheel& wheel, uint64_t delay, uint64_t limit) {
+    bool fired = false;
+    wheel.schedule(delay, [&fired]() { fired = true; });
+
+    std::vector<TimerWheel::Callback> expired;
+    while (wheel.currentTick() < limit) {
+        uint64_t tick = wheel.currentTick();
+        wheel.advance(tick + 1, expired);
+        for (auto& callback : expired) callback();
+        expired.clear();
+        if (fired) return tick;
+    }
+    return UINT64_MAX;
+}
+
+TEST(TimerWheel, FiresOnTimeAcrossLevelBoundaries) {
+    for (uint64_t start : {0ull, 37ull, 4000ull}) {
+        for (uint64_t delay : {0ull, 1ull, 63ull, 64ull, 65ull, 127ull, 128ull, 4095ull, 4096ull, 4097ull, 70000ull}) {
+            TimerWheel wheel(start);
+            EXPECT_EQ(firingTick(wheel, delay, start + delay + 10), start + delay)
+                << "start " << start << ", delay " << delay;
+            EXPECT_EQ(wheel.size(), 0u);
+        }
+    }
+}
+
+TEST(TimerWheel, CancelAfterCascade) {
+    TimerWheel wheel;
+    bool fired = false;
+    TimerWheel::TimerId id = wheel.schedule(5000, [&fired]() { fired = true; });
+
+    // Таймер двічі перенесено на нижчі рівні (на тіках 4096 і 4992)
+    std::vector<TimerWheel::Callback> expired;
+    wheel.advance(4995, expired);
+    EXPECT_TRUE(expired.empty());
+
+    EXPECT_TRUE(wheel.cancel(id));
+    EXPECT_FALSE(wheel.cancel(id));
+    EXPECT_EQ(wheel.size(), 0u);
+
+    wheel.advance(6000, expired);
+    EXPECT_TRUE(expired.empty());
+    EXPECT_FALSE(fired);
+}
+
+TEST(TimerWheel, DelayClampedToMaximum) {
+    TimerWheel wheel(10);
+    std::vector<TimerWheel::Callback> expired;
+    wheel.schedule(UINT64_MAX, []() {});
+    wheel.schedule(TimerWheel::MAX_DELAY + 1000, []() {});
+
+    wheel.advance(10 + TimerWheel::MAX_DELAY, expired);
+    EXPECT_TRUE(expired.empty());
+    wheel.advance(10 + TimerWheel::MAX_DELAY + 1, expired);
+    EXPECT_EQ(expired.size(), 2u);
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+// ================= Кільце вузлів кластера =================
+
+static std::string ringKey(int i) {
+    return "user" + std::to_string(i);
+}
+
+TEST(HashRing, SameNodesGiveSameOwners) {
+    HashRing first, second;
+    for (int node : {1, 2, 3}) first.addNode(node);
+    for (int node : {3, 1, 2}) second.addNode(node);  // Порядок --peers на вузлах різний
+
+    EXPECT_EQ(HashRing().ownerOf("alice"), -1);
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(first.ownerOf(ringKey(i)), second.ownerOf(ringKey(i)));
+    }
+}
+
+TEST(HashRing, VirtualNodesBalanceKeys) {
+    const int keys = 30000;
+    HashRing ring;
+    std::map<int, int> owned;
+    for (int node : {1, 2, 3}) ring.addNode(node);
+    for (int i = 0; i < keys; i++) owned[ring.ownerOf(ringKey(i))]++;
+
+    // 128 точок на вузол - частка кожного в межах 20% від рівної
+    ASSERT_EQ(owned.size(), 3u);
+    for (const auto& pair : owned) {
+        EXPECT_GT(pair.second, keys / 3 * 8 / 10) << "node " << pair.first;
+        EXPECT_LT(pair.second, keys / 3 * 12 / 10) << "node " << pair.first;
+    }
+}
+
+TEST(HashRing, AddedNodeTakesOnlyItsShare) {
+    const int keys = 30000;
+    HashRing before;
+    for (int node : {1, 2, 3}) before.addNode(node);
+    HashRing after = before;
+    after.addNode(4);
+
+    // Переїжджають лише користувачі нового вузла, приблизно чверть
+    int moved = 0;
+    for (int i = 0; i < keys; i++) {
+        int owner = after.ownerOf(ringKey(i));
+        if (owner == before.ownerOf(ringKey(i))) continue;
+        EXPECT_EQ(owner, 4);
+        moved++;
+    }
+    EXPECT_GT(moved, keys * 15 / 100);
+    EXPECT_LT(moved, keys * 35 / 100);
+}
+
+// ================= Сховище чату =================
+
+TEST(ChatStore, HistoryKeepsOrderOfOneConversation) {
+    ChatStore chat;
+    chat.addMessage(Message{"alice", "bob", "1", "", 0});
+    chat.addMessage(Message{"alice", "carol", "x", "", 0});
+    chat.addMessage(Message{"bob", "alice", "2", "", 0});
+
+    std::vector<const Message*> history = chat.history("bob", "alice");
+    ASSERT_EQ(history.size(), 2u);
+    EXPECT_EQ(ChatStore::historyPacket(*history[0]), "MSG:alice|1");
+    EXPECT_EQ(ChatStore::historyPacket(*history[1]), "MSG:bob|2");
+}
+
+TEST(ChatStore, AttachmentAccessLimitedToParticipants) {
+    ChatStore chat;
+    std::string hash(64, 'a');
+    chat.addMessage(Message{"alice", "bob", "", hash + "|10|a.txt", 0});
+
+    EXPECT_TRUE(chat.canDownload(hash, "alice"));
+    EXPECT_TRUE(chat.canDownload(hash, "bob"));
+    EXPECT_FALSE(chat.canDownload(hash, "eve"));
+    EXPECT_EQ(ChatStore::historyPacket(chat.messages[0]), "FILE:alice|" + hash + "|10|a.txt");
+}
+
+// ================= Паролі =================
+
+TEST(PasswordHash, SaltedAndVerified) {
+    std::string first = hashPassword("secret", 1000);
+    std::string second = hashPassword("secret", 1000);
+
+    EXPECT_TRUE(isPasswordHash(first));
+    EXPECT_EQ(first.find("secret"), std::string::npos);
+    EXPECT_NE(first, second);  // Різна сіль
+    EXPECT_TRUE(verifyPassword("secret", first));
+    EXPECT_TRUE(verifyPassword("secret", second));
+    EXPECT_FALSE(verifyPassword("Secret", first));
+    EXPECT_FALSE(verifyPassword("secret", "secret"));  // Відкритий пароль - не запис хешу
+}
+
+TEST(ChatStore, UserListSkipsRemoteDuplicates) {
+    ChatStore chat;
+    chat.users["bob"] = User{"bob", "pw", "HR", true, 7};
+    chat.users["alice"] = User{"alice", "pw", "IT", false, INVALID_CONNECTION};
+
+    std::map<std::string, RemoteUser> remote;
+    remote["bob"] = RemoteUser{"Other", false, 2};
+    remote["carol"] = RemoteUser{"Sales", true, 2};
+
+    EXPECT_EQ(chat.userListPayload(remote), "USERS:alice|IT|0\nbob|HR|1\ncarol|Sales|1");
+    EXPECT_EQ(ChatStore().userListPayload({}), "USERS:");
+}
+
+// ================= Диспетчер команд =================
+
+class DispatcherTest : public ::testing::Test {
+protected:
+    DispatcherTest() : server(blobDir.path) {}
+
+    void loginPair() {
+        server.receive(1, {"REG:alice|pw|IT", "REG:bob|pw|HR", "LOGIN:alice|pw"});
+        server.receive(2, {"LOGIN:bob|pw"});
+        server.take(1);
+        server.take(2);
+    }
+
+    TempDir blobDir;
+    TestServer server;
+};
+
+TEST_F(DispatcherTest, OneCumulativeAckPerBatch) {
+    loginPair();
+    server.receive(1, {"SESSION:phone"});
+    EXPECT_EQ(server.take(1), Frames({"SESSION:0"}));
+
+    server.receive(1, {"MSG:1|bob|a", "MSG:2|bob|b", "MSG:2|bob|b", "MSG:3|bob|c"});
+    EXPECT_EQ(server.take(1), Frames({"ACK:3"}));
+    EXPECT_EQ(server.take(2), Frames({"MSG:alice|a", "MSG:alice|b", "MSG:alice|c"}));
+}
+
+TEST_F(DispatcherTest, DeliveryWindowSurvivesReconnect) {
+    loginPair();
+    server.receive(1, {"SESSION:phone", "MSG:1|bob|a", "MSG:2|bob|b"});
+    server.disconnect(1);
+
+    server.receive(3, {"LOGIN:alice|pw", "SESSION:phone"});
+    Frames replies = server.take(3);
+    ASSERT_FALSE(replies.empty());
+    EXPECT_EQ(replies.back(), "SESSION:2");
+
+    server.take(2);
+    server.receive(3, {"MSG:2|bob|b"});
+    EXPECT_EQ(server.take(3), Frames({"ACK:2"}));
+    EXPECT_TRUE(server.take(2).empty());
+}
+
+TEST_F(DispatcherTest, EvictedWindowRestartsFromZero) {
+    loginPair();
+    server.receive(1, {"SESSION:phone", "MSG:1|bob|a", "MSG:2|bob|b"});
+    server.take(1);
+    server.disconnect(1);
+
+    // Інші clientId того ж користувача витісняють вікно phone
+    for (size_t i = 0; i < MAX_DELIVERY_STATES_PER_USER; i++) {
+        server.dispatcher.deliveryStates.find("alice", "other" + std::to_string(i), time(nullptr));
+    }
+
+    server.receive(3, {"LOGIN:alice|pw", "SESSION:phone"});
+    Frames replies = server.take(3);
+    ASSERT_FALSE(replies.empty());
+    EXPECT_EQ(replies.back(), "SESSION:0");
+
+    // Клієнт перенумерував непідтверджене з 1 (DeliveryQueue::resume) - номер сервера рухається
+    server.take(2);
+    server.receive(3, {"MSG:1|bob|c"});
+    EXPECT_EQ(server.take(3), Frames({"ACK:1"}));
+    EXPECT_EQ(server.take(2), Frames({"MSG:alice|c"}));
+}
+
+TEST_F(DispatcherTest, RateLimitAnsweredOncePerBatch) {
+    Frames burst(CONNECTION_RATE_LIMITS[CMD_QUERY].burst + 5, "GET_USERS");
+    server.receive(1, burst);
+
+    Frames replies = server.take(1);
+    ASSERT_EQ(replies.size(), (size_t)CONNECTION_RATE_LIMITS[CMD_QUERY].burst + 1);
+    EXPECT_EQ(replies.back(), "ERROR:Rate limited");
+
+    server.hooks.now += 1000;  // За секунду відро частково поповнилось
+    server.receive(1, {"GET_USERS"});
+    EXPECT_EQ(server.take(1), Frames({"USERS:"}));
+}
+
+TEST_F(DispatcherTest, AuthFailuresLimitedPerNameAndAddress) {
+    server.receive(1, {"REG:alice|pw|IT"});
+    server.take(1);
+
+    int rejected = 0;
+    const int attempts = (int)USER_RATE_LIMITS[CMD_AUTH].burst + 3;
+    for (ConnectionId connection = 10; connection < 10 + attempts; connection++) {
+        server.session(connection).address = "10.0.0.1";
+        server.receive(connection, {"LOGIN:alice|guess"});
+        Frames replies = server.take(connection);
+        if (replies == Frames({"ERROR:Rate limited"})) rejected++;
+        server.disconnect(connection);
+    }
+
+    // Успішна реєстрація не рахується - лише невдалі спроби з цієї адреси
+    EXPECT_EQ(rejected, 3);
+
+    // Невдачі з іншої адреси не блокують власника
+    server.session(50).address = "10.0.0.2";
+    server.receive(50, {"LOGIN:alice|pw"});
+    Frames replies = server.take(50);
+    ASSERT_FALSE(replies.empty());
+    EXPECT_EQ(replies.front(), "OK:Logged in");
+}
+
+TEST_F(DispatcherTest, DisconnectBroadcastsPresence) {
+    loginPair();
+    int before = server.hooks.userListBroadcasts;
+    server.disconnect(2);
+    EXPECT_EQ(server.hooks.userListBroadcasts, before + 1);
+    EXPECT_TRUE(server.take(1).empty());  // Розсилка відкладена і об'єднується з іншими
+    EXPECT_FALSE(server.chat.users["bob"].online);
+    EXPECT_EQ(server.chat.users["bob"].connection, INVALID_CONNECTION);
+}
+
+TEST_F(DispatcherTest, SecondLoginOnSameConnectionRejected) {
+    loginPair();
+    server.disconnect(2);
+    server.take(1);
+
+    server.receive(1, {"LOGIN:bob|pw"});
+    EXPECT_EQ(server.take(1), Frames({"ERROR:Already logged in"}));
+    EXPECT_FALSE(server.chat.users["bob"].online);
+
+    server.disconnect(1);
+    EXPECT_FALSE(server.chat.users["alice"].online);
+}
+
+TEST_F(DispatcherTest, EventsValidatedBeforeRouting) {
+    loginPair();
+    server.receive(1, {"EVENT:bob|typing|1", "EVENT:bob|typing|2", "EVENT:bob|dancing|1", "EVENT:bob"});
+    EXPECT_EQ(server.hooks.events, std::vector<std::string>({"alice|bob|typing|1"}));
+    EXPECT_TRUE(server.take(1).empty());
+}
+
+TEST_F(DispatcherTest, FieldsBoundedSoDerivedFramesFit) {
+    server.receive(1, {"REG:" + std::string(MAX_NAME_LENGTH + 1, 'x') + "|pw|IT", "REG:carol|pw|a|b"});
+    EXPECT_EQ(server.take(1), Frames({"ERROR:Invalid registration format", "ERROR:Invalid registration format"}));
+
+    loginPair();
+    std::string longest(MAX_MESSAGE_TEXT, 't');
+    server.receive(1, {"MSG:bob|" + longest, "MSG:bob|" + longest + "t"});
+    EXPECT_EQ(server.take(1), Frames({"OK:Sent", "ERROR:Message too long"}));
+
+    // FWD:from|to|text до іншого вузла - найдовший похідний кадр
+    std::string name(MAX_NAME_LENGTH, 'n');
+    EXPECT_LE(("FWD:" + name + "|" + name + "|" + longest).size(), MAX_FRAME_SIZE);
+
+    // Номер зараховано, щоб повтор не зупинив потік повідомлень
+    server.receive(1, {"SESSION:phone", "MSG:1|bob|" + longest + "t", "MSG:2|bob|ok"});
+    EXPECT_EQ(server.take(1), Frames({"SESSION:0", "ERROR:Message too long", "ACK:2"}));
+}
+
+TEST_F(DispatcherTest, KnownHashWithoutAccessNeedsBytes) {
+    loginPair();
+    server.receive(3, {"REG:eve|pw|HR", "LOGIN:eve|pw"});
+
+    std::string data(3000, 'd');
+    std::filesystem::path source = blobDir.path / "source.bin";
+    std::ofstream(source, std::ios::binary) << data;
+    std::string hash = BlobStore::sha256File(source);
+
+    server.receive(1, {"UPLOAD:bob|" + hash + "|3000|a.bin", "CHUNK:" + hash + "|0|" + data});
+    server.take(1);
+    server.take(2);
+    server.take(3);
+
+    // Учасник розмови: без передачі, розмір - справжній, а не заявлений
+    server.receive(1, {"UPLOAD:bob|" + hash + "|1|copy.bin"});
+    EXPECT_EQ(server.take(1), Frames({"UPLOAD_DONE:" + hash}));
+    EXPECT_EQ(server.take(2), Frames({"FILE:alice|" + hash + "|3000|copy.bin"}));
+
+    // Самого хешу недостатньо - потрібні байти
+    server.receive(3, {"UPLOAD:alice|" + hash + "|3000|steal.bin"});
+    EXPECT_EQ(server.take(3), Frames({"UPLOAD_RESUME:" + hash + "|0"}));
+    EXPECT_FALSE(server.chat.canDownload(hash, "eve"));
+
+    server.receive(3, {"CHUNK:" + hash + "|0|" + data});
+    EXPECT_EQ(server.take(3), Frames({"UPLOAD_DONE:" + hash}));
+    EXPECT_TRUE(server.chat.canDownload(hash, "eve"));
+    EXPECT_EQ(server.blobs.pendingBytes("eve"), 0u);
+}
+
+TEST_F(DispatcherTest, QuotaCountsDeclaredUploads) {
+    loginPair();
+
+    // Заявки без жодного шматка теж займають квоту
+    std::string size = std::to_string(MAX_ATTACHMENT_SIZE);
+    size_t fit = (size_t)(MAX_PENDING_UPLOAD_BYTES / MAX_ATTACHMENT_SIZE);
+    for (size_t i = 0; i < fit; i++) {
+        std::string hash(64, (char)('a' + i));
+        server.receive(1, {"UPLOAD:bob|" + hash + "|" + size + "|f.bin"});
+        EXPECT_EQ(server.take(1), Frames({"UPLOAD_RESUME:" + hash + "|0"}));
+    }
+
+    // Повторна заявка того самого файлу не рахується двічі
+    std::string first(64, 'a');
+    server.receive(1, {"UPLOAD:bob|" + first + "|" + size + "|f.bin"});
+    EXPECT_EQ(server.take(1), Frames({"UPLOAD_RESUME:" + first + "|0"}));
+
+    server.receive(1, {"UPLOAD:bob|" + std::string(64, '0') + "|1|f.bin"});
+    EXPECT_EQ(server.take(1), Frames({"ERROR:Too many unfinished uploads"}));
+
+    // Після виходу заявки сесії зникають разом з нею
+    server.disconnect(1);
+    server.receive(1, {"LOGIN:alice|pw", "UPLOAD:bob|" + std::string(64, '0') + "|1|f.bin"});
+    Frames frames = server.take(1);
+    EXPECT_EQ(frames.back(), "UPLOAD_RESUME:" + std::string(64, '0') + "|0");
+}
+
+TEST_F(DispatcherTest, StorageErrorKeepsBytesForRetry) {
+    loginPair();
+
+    std::string data(3000, 's');
+    std::filesystem::path source = blobDir.path / "source.bin";
+    std::ofstream(source, std::ios::binary) << data;
+    std::string hash = BlobStore::sha256File(source);
+
+    // Звичайний файл на місці каталогу блоба - перемістити частину в сховище неможливо
+    std::filesystem::path blocker = server.blobs.path(hash).parent_path();
+    std::ofstream(blocker) << "x";
+
+    server.receive(1, {"UPLOAD:bob|" + hash + "|3000|a.bin", "CHUNK:" + hash + "|0|" + data});
+    EXPECT_EQ(server.take(1), Frames({"UPLOAD_RESUME:" + hash + "|0", "ERROR:Attachment storage failed|" + hash}));
+    EXPECT_TRUE(server.take(2).empty());
+    EXPECT_EQ(server.blobs.partialSize(hash, "alice"), 3000u);
+
+    // Після усунення причини повторна заявка зберігає вже отримані байти
+    std::filesystem::remove(blocker);
+    server.receive(1, {"UPLOAD:bob|" + hash + "|3000|a.bin"});
+    EXPECT_EQ(server.take(1), Frames({"UPLOAD_DONE:" + hash}));
+    EXPECT_EQ(server.take(2), Frames({"FILE:alice|" + hash + "|3000|a.bin"}));
+}
+
+// ================= Відтворення записаного трафіку =================
+
+// Прогнати запис server --record через диспетчер з FakeHooks.
+// Повертає порожній рядок або опис першої розбіжності.
+std::string replayTraffic(std::istream& in) {
+    TempDir blobDir;
+    TestServer server(blobDir.path);
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        std::string where = "line " + std::to_string(lineNumber) + ": ";
+        if (line[0] == '@') {
+            server.hooks.now = strtoull(line.c_str() + 1, nullptr, 10);
+            continue;
+        }
+
+        size_t idEnd = line.find_first_not_of("0123456789");
+        if (idEnd == 0 || idEnd == std::string::npos) return where + "bad event";
+        ConnectionId connection = strtoull(line.substr(0, idEnd).c_str(), nullptr, 10);
+        std::string event = line.substr(idEnd);
+
+        if (event == " open") {
+            server.session(connection);
+        } else if (event == " flush") {
+            server.dispatcher.finishBatch(server.session(connection));
+        } else if (event == " close") {
+            server.disconnect(connection);
+        } else if (event.compare(0, 2, "> ") == 0 || event.compare(0, 2, "< ") == 0) {
+            std::string frame;
+            if (!unescapeFrame(std::string_view(event).substr(2), frame)) return where + "bad escape";
+
+            if (event[0] == '>') {
+                server.dispatcher.process(server.session(connection), frame);
+                continue;
+            }
+
+            std::deque<std::string>& queue = server.hooks.sent[connection];
+            if (queue.empty()) return where + "expected \"" + frame + "\", nothing sent";
+            if (queue.front() != frame) {
+                return where + "expected \"" + frame + "\", got \"" + queue.front() + "\"";
+            }
+            queue.pop_front();
+        } else {
+            return where + "bad event";
+        }
+    }
+
+    for (const auto& pair : server.hooks.sent) {
+        if (!pair.second.empty()) {
+            return "unexpected frame to " + std::to_string(pair.first) + ": \"" + pair.second.front() + "\"";
+        }
+    }
+    return "";
+}
+
+TEST(Replay, RecordedTrafficReplaysIdentically) {
+    std::vector<std::filesystem::path> logs;
+    for (const auto& entry : std::filesystem::directory_iterator(REPLAY_DIR)) {
+        if (entry.path().extension() == ".log") logs.push_back(entry.path());
+    }
+    ASSERT_FALSE(logs.empty()) << "no recordings in " << REPLAY_DIR;
+
+    for (const auto& path : logs) {
+        std::ifstream in(path);
+        ASSERT_TRUE(in) << path;
+        EXPECT_EQ(replayTraffic(in), "") << path.filename();
+    }
+}
+
+TEST(Replay, DetectsDivergence) {
+    std::istringstream wrongReply("1 open\n1> PING\n1< PANG\n");
+    EXPECT_NE(replayTraffic(wrongReply), "");
+
+    std::istringstream missingReply("1 open\n1> PING\n1 close\n");
+    EXPECT_NE(replayTraffic(missingReply), "");
+}